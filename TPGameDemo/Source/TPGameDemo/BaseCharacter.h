@@ -25,15 +25,6 @@ enum class EControlState : uint8
     NumStates
 };
 
-UENUM(BlueprintType)
-enum class EBuildableActorType : uint8
-{
-    None    UMETA (DisplayName = "None"),
-    Turret  UMETA (DisplayName = "Turret"),
-    Mine    UMETA (DisplayName = "Mine"),
-    NumBuildables
-};
-
 enum class EMovementDirectionType : uint8
 {
     Forward   UMETA (DisplayName = "Forward") = 0,
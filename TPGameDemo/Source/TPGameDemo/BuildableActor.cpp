@@ -23,7 +23,7 @@ void ABuildableActor::PlaceItem()
     ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(world->GetGameState());
     if (gameState != nullptr)
     {
-        gameState->SetBuildableItemPlaced(AttachmentRoomAndPosition, AttachmentDirection, true);
+        gameState->SetBuildableItemPlaced(AttachmentRoomAndPosition, AttachmentDirection, true, GetBuildableType());
     }
     ItemWasPlaced();
 }
@@ -39,6 +39,23 @@ void ABuildableActor::UnplaceItem()
     }
 }
 
+EBuildableActorType ABuildableActor::GetBuildableType() const
+{
+    if (BuildableType != EBuildableActorType::None)
+        return BuildableType;
+    // The Blueprints made before BuildableType existed leave it at None.
+    const UEnum* buildableTypes = StaticEnum<EBuildableActorType>();
+    for (const UClass* actorClass = GetClass(); actorClass != nullptr && actorClass != ABuildableActor::StaticClass(); actorClass = actorClass->GetSuperClass())
+    {
+        for (int t = (int)EBuildableActorType::None + 1; t < (int)EBuildableActorType::NumBuildables; ++t)
+        {
+            if (actorClass->GetName() == buildableTypes->GetNameStringByValue(t) + TEXT("_C"))
+                return (EBuildableActorType)t;
+        }
+    }
+    return EBuildableActorType::None;
+}
+
 bool ABuildableActor::CanItemBePlaced() const
 {
     return CanBePlaced;
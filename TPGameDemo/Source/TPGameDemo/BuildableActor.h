@@ -47,6 +47,15 @@ public:
     UPROPERTY(BlueprintReadWrite, Category = "Buildable Items Resources Cost")
         EDirectionType AttachmentDirection;
 
+    /* What the game state registers the item as when it's placed. Left at None, it's worked out from the class (see GetBuildableType). */
+    UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Buildable Items")
+        EBuildableActorType BuildableType = EBuildableActorType::None;
+
+    /* BuildableType, or if that's None, the type the item's Blueprint class is named after (Turret_C is a Turret), or that one of 
+       its parent Blueprints is named after. */
+    UFUNCTION(BlueprintCallable, Category = "Buildable Items")
+        EBuildableActorType GetBuildableType() const;
+
 private:
 	bool IsPlaced = false;
     bool CanBePlaced = true;
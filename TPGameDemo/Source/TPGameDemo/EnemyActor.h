@@ -1,6 +1,7 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #pragma once
+#include <set>
 #include "TPGameDemo.h"
 #include "MazeActor.h"
 #include "TPGameDemoGameState.h"
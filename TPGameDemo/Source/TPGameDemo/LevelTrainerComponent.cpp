@@ -9,10 +9,12 @@
 // LevelTrainerRunnable
 //====================================================================================================
 
-LevelTrainerRunnable::LevelTrainerRunnable(ULevelTrainerComponent& trainerComponent) 
-    : TrainerComponent(trainerComponent)
+LevelTrainerRunnable::LevelTrainerRunnable(ULevelTrainerComponent& trainerComponent, const FTrainingCancellationTokenRef& cancellationToken, 
+                                           const RoomTargetsQValuesRewardsSetsPtr& qValuesRewardsSets) 
+    : TrainerComponent(trainerComponent), CancellationToken(cancellationToken), QValuesRewardsSets(qValuesRewardsSets)
 {
-    WaitEvent = FPlatformProcess::GetSynchEventFromPool(true);
+    // Auto-reset, so each wake releases one wait and the thread goes back to sleep the next time it is paused.
+    WaitEvent = FPlatformProcess::GetSynchEventFromPool(false);
 }
 
 LevelTrainerRunnable::~LevelTrainerRunnable()
@@ -27,6 +29,11 @@ void LevelTrainerRunnable::Wake()
     WaitEvent->Trigger();
 }
 
+TFuture<void> LevelTrainerRunnable::GetCompletionFuture()
+{
+    return CompletionPromise.GetFuture();
+}
+
 /* FRunnable interface */
 bool LevelTrainerRunnable::Init()
 {
@@ -35,25 +42,26 @@ bool LevelTrainerRunnable::Init()
 
 uint32 LevelTrainerRunnable::Run()
 {
-    IsTraining = true;
     ensure(!IsInGameThread());
-    while (!ThreadShouldExit)
+    while (!CancellationToken->IsCancelled() && !TrainerComponent.LevelTrained)
     {
-        if (ShouldTrain)
+        if (!ShouldTrain)
         {
-            TrainerComponent.TrainNextGoalPosition(NUM_TRAINING_SIMULATIONS, MAX_NUM_MOVEMENTS_PER_SIMULATION);
-            if (TrainerComponent.LevelTrained)
-                ThreadShouldExit = true;
+            WaitEvent->Wait();
+            continue;
         }
+        IsTraining = true;
+        TrainerComponent.TrainNextGoalPosition(*QValuesRewardsSets, NUM_TRAINING_SIMULATIONS, MAX_NUM_MOVEMENTS_PER_SIMULATION);
         IsTraining = false;
     }
-    IsTraining = false;
+    CompletionPromise.SetValue();
     return 0;
 }
 
 void LevelTrainerRunnable::StartTraining()
 {
     ShouldTrain = true;
+    Wake();
 }
 
 void LevelTrainerRunnable::PauseTraining()
@@ -63,12 +71,12 @@ void LevelTrainerRunnable::PauseTraining()
 
 void LevelTrainerRunnable::Stop()
 {
-    ThreadShouldExit = true;
+    CancellationToken->Cancel();
+    Wake();
 }
 
 void LevelTrainerRunnable::Exit()
 {
-    ThreadShouldExit = true;
 }
 
 //====================================================================================================
@@ -84,12 +92,12 @@ ULevelTrainerComponent::ULevelTrainerComponent()
     {
         if (IsValid(this))
         {
+            // The trainer thread only works on its pinned room payload, so it doesn't need to finish before the world goes. 
+            // It is joined in FinishDestroy.
             if (TrainerRunnable.IsValid())
             {
                 UE_LOG(LogTemp, Warning, TEXT("Exiting training thread."));
-                TrainerRunnable->Exit();
-                TrainerRunnable->Wake();
-                while (TrainerRunnable->IsTraining) {}
+                TrainerRunnable->Stop();
             }
             FWorldDelegates::OnWorldCleanup.Remove(WorldCleanupHandle);
         }
@@ -98,33 +106,58 @@ ULevelTrainerComponent::ULevelTrainerComponent()
 
 void ULevelTrainerComponent::BeginDestroy()
 {
-
     if (TrainerRunnable.IsValid())
-    {
-        TrainerRunnable->Exit();
-        TrainerRunnable->Wake();
-    }
-    if (TrainerThread.IsValid())
-    {
-        if (!TrainerThread->Kill(true))
-        {
-            UE_LOG(LogTemp, Error, TEXT("Trainer Thread Failed to Exit!"));
-        }
-    }
-    if (TrainerRunnable.IsValid())
-    {
-        while (TrainerRunnable->IsTraining){}
-    }
-    TrainerRunnable = nullptr;
+        TrainerRunnable->Stop();
     FWorldDelegates::OnWorldCleanup.Remove(WorldCleanupHandle);
     Super::BeginDestroy();
 }
 
+bool ULevelTrainerComponent::IsReadyForFinishDestroy()
+{
+    // Polled by the garbage collector, so a trainer thread finishing its current goal doesn't stall the frame.
+    bool trainerFinished = !TrainerCompletion.IsValid() || TrainerCompletion.IsReady();
+    for (const FRetiredTrainer& retiredTrainer : RetiredTrainers)
+        trainerFinished = trainerFinished && (!retiredTrainer.Completion.IsValid() || retiredTrainer.Completion.IsReady());
+    return trainerFinished && Super::IsReadyForFinishDestroy();
+}
+
+void ULevelTrainerComponent::FinishDestroy()
+{
+    ReleaseTrainerThread();
+    JoinRetiredTrainers(true);
+    ReleaseTrainingPayload();
+    Super::FinishDestroy();
+}
+
 void ULevelTrainerComponent::TickComponent( float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction )
 {
-    if (LevelTrained)
+    if (RetiredTrainers.Num() > 0 && JoinRetiredTrainers(false))
+    {
+        // A full restart covers any retrain that was waiting too.
+        if (bStartTrainingWhenReleased)
+            StartTraining();
+        else if (bRetrainWhenReleased)
+            RetrainChangedEnvironment();
+        bStartTrainingWhenReleased = false;
+        bRetrainWhenReleased = false;
+    }
+    // Whatever the cancelled run finished doesn't count until the restart has gone through.
+    if (bStartTrainingWhenReleased || bRetrainWhenReleased)
+        return;
+    if (LevelTrained && (!TrainerCompletion.IsValid() || TrainerCompletion.IsReady()))
     {
-        while(TrainerRunnable.IsValid() && TrainerRunnable->IsTraining){}            
+        // The thread has finished, so it's joined straight away.
+        ReleaseTrainerThread();
+        JoinRetiredTrainers(false);
+        ReleaseTrainingPayload();
+        ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
+        if (gameState != nullptr)
+            gameState->AddRoomTablesToTrainedCache(RoomCoords);
+        if (NumSimulationsFixedBudget.GetValue() > 0)
+        {
+            UE_LOG(LogTemp, Log, TEXT("Room (%d, %d) trained with %d simulations (%d saved)."), RoomCoords.X, RoomCoords.Y, 
+                   NumSimulationsRun.GetValue(), GetNumSimulationsSaved());
+        }
         OnLevelTrained.Broadcast();
         LevelTrained = false;
     }
@@ -132,15 +165,51 @@ void ULevelTrainerComponent::TickComponent( float DeltaTime, ELevelTick TickType
 
 void ULevelTrainerComponent::StartTraining()
 {
-    if(TrainerRunnable.IsValid())
-        TrainerRunnable->Stop();
-    if (TrainerThread.IsValid())
+    // Restarting cancels any previous run; it stops at the end of its current goal, and training starts again once it has.
+    ReleaseTrainerThread();
+    if (!JoinRetiredTrainers(false))
+    {
+        bStartTrainingWhenReleased = true;
+        return;
+    }
+    // The cancelled run may have finished the level before it saw the cancellation.
+    LevelTrained = false;
+    NumSimulationsRun.Reset();
+    NumSimulationsFixedBudget.Reset();
+    ReleaseTrainingPayload();
+    ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
+    if (gameState != nullptr)
+        TrainingPayload = gameState->GetRoomPayload(RoomCoords);
+    // A room with the same layout as one that's already been trained just shares its tables.
+    if (gameState != nullptr && gameState->ShareTrainedRoomTables(RoomCoords))
+    {
+        TrainingPosition.Set(MaxTrainingPosition.GetValue());
+        LevelTrained = true;
+        return;
+    }
+    if (!TrainingPayload.IsValid())
+    {
+        LevelTrained = true;
+        return;
+    }
+    // The tables have to be laid out for the room before training writes to them.
+    TrainingPayload->ReindexQValuesRewardsSets();
+    TrainingPayload->RealtimeLearning.ResetQValueDeltas();
+    if (SolverMode == ETrainingSolverMode::Exact)
     {
-        TrainerThread->WaitForCompletion();
-        TrainerThread.Reset();
+        // Solving a whole room takes a fraction of a millisecond, so there's no need for the trainer thread.
+        SolveAllGoalPositions();
+        LevelTrained = true;
+        return;
     }
-    if(TrainerRunnable.IsValid())
-        TrainerRunnable.Reset();
+    // Pinned here on the game thread, so the trainer thread never has to ask the payload for its tables, which could swap them.
+    TrainingQValuesRewardsSets = TrainingPayload->PinForTraining();
+    SweepKernel.Reset();
+    LockstepKernel.Reset();
+    if (SolverMode == ETrainingSolverMode::Sweep)
+        SweepKernel = MakeUnique<BellmanSweepKernel>(TrainingPayload->NavEnvironment);
+    if (SolverMode == ETrainingSolverMode::Simulated && bLockstepSimulatedRuns)
+        LockstepKernel = MakeUnique<LockstepEpisodeKernel>(TrainingPayload->NavEnvironment);
     InitTrainerThread();
     TrainerRunnable->StartTraining();
 }
@@ -151,14 +220,56 @@ void ULevelTrainerComponent::PauseTraining()
         TrainerRunnable->PauseTraining();
 }
 
+void ULevelTrainerComponent::ResumeTraining()
+{
+    if (TrainerRunnable.IsValid())
+        TrainerRunnable->StartTraining();
+}
+
+void ULevelTrainerComponent::ReleaseTrainerThread()
+{
+    if (TrainerRunnable.IsValid())
+        TrainerRunnable->Stop();
+    // Joining it here would stall the game thread until it finishes its current goal.
+    if (TrainerThread.IsValid())
+        RetiredTrainers.Add({ TrainerRunnable, TrainerThread, MoveTemp(TrainerCompletion) });
+    TrainerThread.Reset();
+    TrainerRunnable.Reset();
+    TrainerCompletion = TFuture<void>();
+}
+
+bool ULevelTrainerComponent::JoinRetiredTrainers(bool waitForCompletion)
+{
+    for (int i = RetiredTrainers.Num() - 1; i >= 0; --i)
+    {
+        FRetiredTrainer& retiredTrainer = RetiredTrainers[i];
+        if (!waitForCompletion && retiredTrainer.Completion.IsValid() && !retiredTrainer.Completion.IsReady())
+            continue;
+        // Run has set the completion as it returns, so this doesn't wait long.
+        retiredTrainer.Thread->WaitForCompletion();
+        RetiredTrainers.RemoveAtSwap(i);
+    }
+    return RetiredTrainers.Num() == 0;
+}
+
 void ULevelTrainerComponent::InitTrainerThread()
 {
-    TrainerRunnable = MakeShareable(new LevelTrainerRunnable(*this));
+    CancellationToken = MakeShared<FTrainingCancellationToken, ESPMode::ThreadSafe>();
+    TrainerRunnable = MakeShareable(new LevelTrainerRunnable(*this, CancellationToken.ToSharedRef(), TrainingQValuesRewardsSets));
+    TrainerCompletion = TrainerRunnable->GetCompletionFuture();
     FString ThreadName(FString::Printf(TEXT("LevelTrainerThread%i"), ThreadCounter.Increment()));
     TrainerThread = MakeShareable(FRunnableThread::Create(TrainerRunnable.Get(), *ThreadName, 0,
                                     EThreadPriority::TPri_BelowNormal));
 }
 
+void ULevelTrainerComponent::ReleaseTrainingPayload()
+{
+    if (TrainingQValuesRewardsSets.IsValid())
+        TrainingPayload->UnpinFromTraining();
+    TrainingQValuesRewardsSets.Reset();
+    TrainingPayload.Reset();
+}
+
 void ULevelTrainerComponent::RegisterLevelTrainedCallback(const FOnLevelTrained& Callback)
 {
     OnLevelTrained.AddLambda([Callback]()
@@ -199,6 +310,10 @@ void ULevelTrainerComponent::UpdateEnvironmentForLevel()
         const int sizeY = LevelStructure[0].Num();
         MaxTrainingPosition.Set(sizeX * sizeY - 1.0f);
     
+        // Keep the old environment around so the trained values can be patched up rather than retrained from scratch.
+        RoomPayloadPtr payload = gameState->GetRoomPayload(RoomCoords);
+        // A frozen room has no values to patch up. It is baked again, or thawed for a full retrain, as its structure changes.
+        PreviousNavEnvironment = payload.IsValid() && !payload->IsFrozen() ? payload->NavEnvironment : NavigationEnvironment();
         gameState->UpdateRoomNavEnvironmentForStructure(RoomCoords, LevelStructure);
 
         /*UE_LOG(LogTemp, Warning, TEXT("Loaded Level:"));
@@ -206,54 +321,232 @@ void ULevelTrainerComponent::UpdateEnvironmentForLevel()
     }
 }
 
-void ULevelTrainerComponent::TrainNextGoalPosition(int numSimulationsPerStartingPosition, int maxNumActionsPerSimulation)
+bool ULevelTrainerComponent::RetrainChangedEnvironment()
 {
-    ClearEnvironment();
-    float maxGoalDistance = sqrt(pow((GetNavEnvironment().Num() - 1), 2.0f) + pow((GetNavEnvironment()[0].Num() - 1), 2.0f));
-    if (Get_ActionTargets(GetNavEnvironment(), CurrentGoalPosition).IsStateValid())
+    ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
+    if (gameState == nullptr)
+        return false;
+    RoomPayloadPtr payload = gameState->GetRoomPayload(RoomCoords);
+    // A frozen room has no Q values to repair. It was baked again for its new structure in UpdateEnvironmentForLevel.
+    if (payload.IsValid() && payload->IsFrozen())
     {
-        ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
-        if (gameState != nullptr)
+        PreviousNavEnvironment.Empty();
+        LevelTrained = true;
+        return true;
+    }
+    if (PreviousNavEnvironment.NumX() == 0 || !payload.IsValid() || payload->NavEnvironment.NumX() != PreviousNavEnvironment.NumX() || payload->NavEnvironment.NumY() != PreviousNavEnvironment.NumY())
+        return false;
+    // The trainer thread writes the same Q tables, so it has to be out of the way first. A full restart will cover the changes anyway.
+    ReleaseTrainerThread();
+    if (bStartTrainingWhenReleased)
+        return true;
+    if (!JoinRetiredTrainers(false))
+    {
+        bRetrainWhenReleased = true;
+        return true;
+    }
+    ReleaseTrainingPayload();
+    // Cells that opened up get entries, starting out as in fresh tables; the ones that closed lose theirs.
+    payload->ReindexQValuesRewardsSets();
+    PrioritizedSweepRetrainer retrainer(PreviousNavEnvironment, payload->NavEnvironment);
+    if (retrainer.HasChanges())
+    {
+        const NavigationEnvironment& environment = payload->NavEnvironment;
+        for (int x = 0; x < environment.NumX(); ++x)
         {
-            gameState->SetPositionIsGoal(RoomCoords, CurrentGoalPosition, true);
+            for (int y = 0; y < environment.NumY(); ++y)
+            {
+                QValuesRewardsSet qValuesRewardsSet = payload->GetMutableQValuesRewardsSets().GetQValuesRewardsSet(FIntPoint(x, y));
+                retrainer.RetrainGoal(qValuesRewardsSet, FIntPoint(x, y), GridTrainingConstants::SimDiscountFactor);
+            }
         }
-        for(int x = 0; x < GetNavEnvironment().Num(); ++x)
+    }
+    payload->RealtimeLearning.ResetQValueDeltas();
+    PreviousNavEnvironment.Empty();
+    LevelTrained = true;
+    return true;
+}
+
+void ULevelTrainerComponent::TrainNextGoalPosition(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, int numSimulationsPerStartingPosition, int maxNumActionsPerSimulation)
+{
+    ClearEnvironment(qValuesRewardsSets);
+    if (SweepKernel.IsValid())
+    {
+        if (Get_ActionTargets(GetNavEnvironment(), CurrentGoalPosition).IsStateValid())
+            SweepGoalPosition(qValuesRewardsSets, CurrentGoalPosition);
+        IncrementGoalPosition();
+        return;
+    }
+    if (Get_ActionTargets(GetNavEnvironment(), CurrentGoalPosition).IsStateValid())
+    {
+        Get_mActionTargets(TrainingPayload->NavEnvironment, CurrentGoalPosition).SetIsGoal(true);
+        const int sizeY = GetNavEnvironment().NumY();
+        TArray<FIntPoint> goalBFSOrder;
+        TArray<int32> pathDistances;
+        GetGoalDistances(CurrentGoalPosition, goalBFSOrder, pathDistances);
+        const FIntPoint furthestPosition = goalBFSOrder.Last();
+        const int maxPathDistance = FMath::Max(1, pathDistances[furthestPosition.X * sizeY + furthestPosition.Y]);
+        for(int x = 0; x < GetNavEnvironment().NumX() && !IsTrainingCancelled(); ++x)
         {
-            for(int y = 0; y < GetNavEnvironment()[0].Num(); ++y)
+            for(int y = 0; y < sizeY; ++y)
             {
                 if (Get_ActionTargets(GetNavEnvironment(), FIntPoint(x, y)).IsStateValid() && FIntPoint(x, y) != CurrentGoalPosition)
                 {
-                    bool deltaQConverged = false;
-                    int s = 0;
-                    float distanceFromGoal = sqrt(pow((CurrentGoalPosition.X - x), 2.0f) + pow((CurrentGoalPosition.Y - y), 2.0f));
-                    float normedDistanceFromGoal = (distanceFromGoal - 1.0f) / (maxGoalDistance - 1.0f);
+                    const int pathDistance = pathDistances[x * sizeY + y];
+                    const int simulationBudget = GetSimulationBudget(FIntPoint(x, y), pathDistance, maxPathDistance, numSimulationsPerStartingPosition);
+                    float normedDistanceFromGoal = pathDistance == INDEX_NONE ? 1.0f : (pathDistance - 1.0f) / FMath::Max(1.0f, maxPathDistance - 1.0f);
                     int actionsTakenConvergenceThreshold = (int)(normedDistanceFromGoal * (CONVERGENCE_NUM_ACTIONS_MAX - CONVERGENCE_NUM_ACTIONS_MIN)) + CONVERGENCE_NUM_ACTIONS_MIN;
-                    while (/*!deltaQConverged &&*/ s < numSimulationsPerStartingPosition)
+                    int s = 0;
+                    int totalActionsTaken = 0;
+                    int numConvergedChecks = 0;
+                    // Stop once enough actions have been seen from this start and deltaQ has stayed small for a few checks in a row.
+                    while (numConvergedChecks < CONVERGENCE_NUM_CHECKS && s < simulationBudget)
                     {
                         float averageDeltaQ = 0.0f;
                         int numActionsTaken = 0;
-                        SimulateRun(FIntPoint(x, y), maxNumActionsPerSimulation, averageDeltaQ, numActionsTaken);
-                        deltaQConverged = numActionsTaken >= actionsTakenConvergenceThreshold && averageDeltaQ <= DELTA_Q_CONVERGENCE_THRESHOLD;
-                        ++s;
+                        int numRuns = 1;
+                        if (LockstepKernel.IsValid())
+                        {
+                            numRuns = FMath::Min(LockstepEpisodeKernel::NumLanes, simulationBudget - s);
+                            QValuesRewardsSet qValuesRewardsSet = qValuesRewardsSets.GetQValuesRewardsSet(CurrentGoalPosition);
+                            LockstepKernel->SimulateRuns(qValuesRewardsSet, CurrentGoalPosition, FIntPoint(x, y), numRuns, maxNumActionsPerSimulation, 
+                                                         GridTrainingConstants::SimLearningRate, GridTrainingConstants::SimDiscountFactor, averageDeltaQ, numActionsTaken);
+                        }
+                        else
+                        {
+                            SimulateRun(qValuesRewardsSets, FIntPoint(x, y), maxNumActionsPerSimulation, averageDeltaQ, numActionsTaken);
+                        }
+                        totalActionsTaken += numActionsTaken * numRuns;
+                        const bool deltaQConverged = totalActionsTaken >= actionsTakenConvergenceThreshold && FMath::Abs(averageDeltaQ) <= DELTA_Q_CONVERGENCE_THRESHOLD;
+                        // A converged lockstep batch counts once per run in it, as its runs would have one at a time. Counting it once 
+                        // would take CONVERGENCE_NUM_CHECKS whole batches, which is most of the budget.
+                        numConvergedChecks = deltaQConverged ? numConvergedChecks + numRuns : 0;
+                        s += numRuns;
                     }
+                    NumSimulationsRun.Add(s);
+                    NumSimulationsFixedBudget.Add(numSimulationsPerStartingPosition);
                 }
             }
         }
-        UWorld* world = GetWorld();
-        if (IsValid(world))
+        Get_mActionTargets(TrainingPayload->NavEnvironment, CurrentGoalPosition).SetIsGoal(false);
+    }
+    // A cancelled goal is left to be trained again when training restarts.
+    if (IsTrainingCancelled())
+        return;
+    IncrementGoalPosition();
+}
+
+void ULevelTrainerComponent::GetGoalDistances(FIntPoint goalPosition, TArray<FIntPoint>& outBFSOrder, TArray<int32>& outPathDistances) const
+{
+    const NavigationEnvironment& environment = GetNavEnvironment();
+    const int sizeX = environment.NumX();
+    const int sizeY = environment.NumY();
+    outBFSOrder.Reset(sizeX * sizeY);
+    outPathDistances.Init(INDEX_NONE, sizeX * sizeY);
+    outBFSOrder.Add(goalPosition);
+    outPathDistances[goalPosition.X * sizeY + goalPosition.Y] = 0;
+    for (int i = 0; i < outBFSOrder.Num(); ++i)
+    {
+        const FIntPoint position = outBFSOrder[i];
+        const int nextDistance = outPathDistances[position.X * sizeY + position.Y] + 1;
+        for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
         {
-            ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(world->GetGameState());
-            if (gameState != nullptr)
+            const FIntPoint neighbour = LevelBuilderHelpers::GetTargetPointForAction(position, (EDirectionType)a);
+            if (!LevelBuilderHelpers::GridPositionIsValid(neighbour, sizeX, sizeY) || outPathDistances[neighbour.X * sizeY + neighbour.Y] != INDEX_NONE)
+                continue;
+            const EDirectionType actionToPosition = DirectionHelpers::GetOppositeDirection((EDirectionType)a);
+            if (Get_ActionTargets(environment, neighbour).IsStateValid() && Get_InRoomActionTarget(environment, neighbour, actionToPosition) == position)
             {
-                gameState->SetRoomQValuesRewardsSet(RoomCoords, CurrentGoalPosition, Get_QValuesRewardsSet_For_GoalPosition(GetNavSets(), CurrentGoalPosition));
+                outPathDistances[neighbour.X * sizeY + neighbour.Y] = nextDistance;
+                outBFSOrder.Add(neighbour);
             }
         }
-        if (gameState != nullptr)
+    }
+}
+
+int ULevelTrainerComponent::GetSimulationBudget(FIntPoint startPosition, int pathDistance, int maxPathDistance, int baseBudget) const
+{
+    // Cells that can't reach the goal only need to learn that every move costs.
+    if (pathDistance == INDEX_NONE)
+        return MIN_NUM_TRAINING_SIMULATIONS;
+    const int straightDistance = FMath::Max(1, FMath::Abs(startPosition.X - CurrentGoalPosition.X) + FMath::Abs(startPosition.Y - CurrentGoalPosition.Y));
+    // Far cells, and cells that have to go round walls to reach the goal, get more runs.
+    const float detourFactor = pathDistance / (float)straightDistance;
+    const float distanceFactor = 0.5f + pathDistance / (float)maxPathDistance;
+    return FMath::Clamp(FMath::RoundToInt(baseBudget * distanceFactor * detourFactor), MIN_NUM_TRAINING_SIMULATIONS, MAX_NUM_TRAINING_SIMULATIONS);
+}
+
+void ULevelTrainerComponent::SolveGoalPosition(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, FIntPoint goalPosition)
+{
+    const NavigationEnvironment& environment = GetNavEnvironment();
+    QValuesRewardsSet qValuesRewardsSet = qValuesRewardsSets.GetQValuesRewardsSet(goalPosition);
+    qValuesRewardsSet.ResetQValues();
+    if (!Get_ActionTargets(environment, goalPosition).IsStateValid())
+        return;
+
+    // Cells are swept in backward BFS order from the goal, so each cell comes after the cell it should move to. 
+    // Cells that can't reach the goal go at the end.
+    const int sizeY = environment.NumY();
+    TArray<FIntPoint> sweepOrder;
+    TArray<int32> pathDistances;
+    GetGoalDistances(goalPosition, sweepOrder, pathDistances);
+    for (int x = 0; x < environment.NumX(); ++x)
+    {
+        for (int y = 0; y < sizeY; ++y)
         {
-            gameState->SetPositionIsGoal(RoomCoords, CurrentGoalPosition, false);
+            if (pathDistances[x * sizeY + y] == INDEX_NONE && Get_ActionTargets(environment, FIntPoint(x, y)).IsStateValid())
+                sweepOrder.Add(FIntPoint(x, y));
         }
     }
-    IncrementGoalPosition();
+
+    // The goal is terminal, so its value stays at 0. Sweeps are in place, so values propagate along the BFS order within a single sweep.
+    TArray<float> cellValues;
+    cellValues.SetNumZeroed(environment.NumX() * sizeY);
+    for (int sweep = 0; sweep < GridTrainingConstants::ExactSolverMaxSweeps; ++sweep)
+    {
+        float maxDeltaQ = 0.0f;
+        for (int i = 1; i < sweepOrder.Num(); ++i)
+        {
+            const FIntPoint position = sweepOrder[i];
+            ActionQValuesAndRewards qValuesRewards = qValuesRewardsSet.GetActionQValuesAndRewards(position);
+            float cellValue = -MAX_FLT;
+            for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+            {
+                const FIntPoint target = Get_InRoomActionTarget(environment, position, (EDirectionType)a);
+                const float qValue = GridTrainingConstants::LearningRuleFixedPointScale * (qValuesRewards.GetRewards()[a] + GridTrainingConstants::SimDiscountFactor * cellValues[target.X * sizeY + target.Y]);
+                maxDeltaQ = FMath::Max(maxDeltaQ, FMath::Abs(qValue - qValuesRewards.GetQValue((EDirectionType)a)));
+                qValuesRewards.UpdateQValue((EDirectionType)a, 1.0f, qValue);
+                cellValue = FMath::Max(cellValue, qValue);
+            }
+            cellValues[position.X * sizeY + position.Y] = cellValue;
+        }
+        if (maxDeltaQ <= GridTrainingConstants::ExactSolverTolerance)
+            break;
+    }
+}
+
+void ULevelTrainerComponent::SolveAllGoalPositions()
+{
+    const NavigationEnvironment& environment = GetNavEnvironment();
+    RoomTargetsQValuesRewardsSets& qValuesRewardsSets = TrainingPayload->GetMutableQValuesRewardsSets();
+    for (int x = 0; x < environment.NumX(); ++x)
+    {
+        for (int y = 0; y < environment.NumY(); ++y)
+            SolveGoalPosition(qValuesRewardsSets, FIntPoint(x, y));
+    }
+    CurrentGoalPosition = FIntPoint(0, 0);
+    TrainingPosition.Set(MaxTrainingPosition.GetValue());
+}
+
+void ULevelTrainerComponent::SweepGoalPosition(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, FIntPoint goalPosition)
+{
+    QValuesRewardsSet qValuesRewardsSet = qValuesRewardsSets.GetQValuesRewardsSet(goalPosition);
+    for (int sweep = 0; sweep < GridTrainingConstants::ExactSolverMaxSweeps; ++sweep)
+    {
+        const float maxDeltaQ = SweepKernel->Sweep(qValuesRewardsSet, goalPosition, GridTrainingConstants::SimLearningRate, GridTrainingConstants::SimDiscountFactor);
+        if (maxDeltaQ <= GridTrainingConstants::ExactSolverTolerance)
+            break;
+    }
 }
 
 void ULevelTrainerComponent::ResetGoalPosition()
@@ -264,18 +557,18 @@ void ULevelTrainerComponent::ResetGoalPosition()
 BehaviourMap ULevelTrainerComponent::GetBehaviourMap()
 {
     BehaviourMap outArray;
-    outArray.Reserve(GetNavEnvironment().Num());
-    for (int x = 0; x < GetNavEnvironment().Num(); ++x)
+    outArray.Reserve(GetNavEnvironment().NumX());
+    for (int x = 0; x < GetNavEnvironment().NumX(); ++x)
     {
         outArray.Add(TArray<FDirectionSet>());
-        for (int y = 0; y < GetNavEnvironment()[0].Num(); ++y)
+        for (int y = 0; y < GetNavEnvironment().NumY(); ++y)
         {
             outArray[x].Add(FDirectionSet());
             FDirectionSet& directionSet = outArray[x][y];
             directionSet.Clear();
             if (Get_ActionTargets(GetNavEnvironment(), FIntPoint(x, y)).IsStateValid())
             {
-                Get_ActionQValuesAndRewards_FromRoom(GetNavSets(), CurrentGoalPosition, FIntPoint(x, y)).GetOptimalQValueAndActions(directionSet);
+                GetNavSets().GetActionQValuesAndRewards(CurrentGoalPosition, FIntPoint(x, y)).GetOptimalQValueAndActions(directionSet);
                 ensure(directionSet.IsValid());
             }
         }
@@ -283,28 +576,24 @@ BehaviourMap ULevelTrainerComponent::GetBehaviourMap()
     return outArray;
 }
 
-void ULevelTrainerComponent::ClearEnvironment()
+void ULevelTrainerComponent::ClearEnvironment(RoomTargetsQValuesRewardsSets& qValuesRewardsSets)
 {
-    ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
-    ensure(gameState != nullptr);
-    return gameState->ClearQValuesAndRewards(RoomCoords, CurrentGoalPosition);
+    qValuesRewardsSets.GetQValuesRewardsSet(CurrentGoalPosition).ResetQValues();
 }
 
 const RoomTargetsQValuesRewardsSets& ULevelTrainerComponent::GetNavSets() const
 {
-    ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
-    ensure(gameState != nullptr);
-    return gameState->GetRoomQValuesRewardsSets(RoomCoords);
+    static const RoomTargetsQValuesRewardsSets EmptyQValuesRewardsSets;
+    return TrainingPayload.IsValid() ? TrainingPayload->GetQValuesRewardsSets() : EmptyQValuesRewardsSets;
 }
 
 const NavigationEnvironment& ULevelTrainerComponent::GetNavEnvironment() const
 {
-    ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
-    ensure(gameState != nullptr);
-    return gameState->GetNavEnvironment(RoomCoords);
+    static const NavigationEnvironment EmptyNavEnvironment;
+    return TrainingPayload.IsValid() ? TrainingPayload->NavEnvironment : EmptyNavEnvironment;
 }
 
-void ULevelTrainerComponent::SimulateRun(FIntPoint startingStatePosition, int maxNumActions, float& averageDeltaQ, int& numActionsTaken)
+void ULevelTrainerComponent::SimulateRun(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, FIntPoint startingStatePosition, int maxNumActions, float& averageDeltaQ, int& numActionsTaken)
 {
     numActionsTaken = 0;
     averageDeltaQ = 0.0f;
@@ -315,26 +604,20 @@ void ULevelTrainerComponent::SimulateRun(FIntPoint startingStatePosition, int ma
     while (numActionsTaken < maxNumActions && !goalReached)
     {
         FDirectionSet optimalActions;
-        const ActionQValuesAndRewards& qValuesRewards = Get_ActionQValuesAndRewards_FromRoom(GetNavSets(), CurrentGoalPosition, currentPosition);
-        const ActionTargets& targets = Get_ActionTargets(GetNavEnvironment(), currentPosition);
+        ActionQValuesAndRewards qValuesRewards = qValuesRewardsSets.GetActionQValuesAndRewards(CurrentGoalPosition, currentPosition);
         qValuesRewards.GetOptimalQValueAndActions(optimalActions);
         ensure(optimalActions.IsValid());
         EDirectionType actionToTake = optimalActions.ChooseDirection();
         FDirectionSet dummyNextActions;
-        FRoomPositionPair actionTarget = targets.GetActionTarget(actionToTake);
-        const float maxNextReward = Get_ActionQValuesAndRewards_FromRoom(GetNavSets(), CurrentGoalPosition, actionTarget.PositionInRoom).GetOptimalQValueAndActions(dummyNextActions);
-        const float currentQValue = qValuesRewards.GetQValues()[(int)actionToTake];
+        const FIntPoint actionTarget = GetNavEnvironment().GetInRoomActionTarget(currentPosition, actionToTake);
+        const float maxNextReward = qValuesRewardsSets.GetActionQValuesAndRewards(CurrentGoalPosition, actionTarget).GetOptimalQValueAndActions(dummyNextActions);
+        const float currentQValue = qValuesRewards.GetQValue(actionToTake);
         const float discountedNextReward = GridTrainingConstants::SimDiscountFactor * maxNextReward;
         const float immediateReward = qValuesRewards.GetRewards()[(int)actionToTake];
         const float deltaQ = GridTrainingConstants::SimLearningRate * (immediateReward + discountedNextReward - currentQValue);
         averageDeltaQ += deltaQ;
-        ATPGameDemoGameState* gameState = (ATPGameDemoGameState*)(GetWorld()->GetGameState());
-        if (gameState != nullptr)
-        {
-            gameState->UpdateQValue({ RoomCoords, currentPosition }, CurrentGoalPosition, actionToTake, GridTrainingConstants::SimLearningRate, deltaQ);
-        }
-#pragma message("Careful here! This assumes the room never changes, during training. If we come back and train a room again after the doors have been unlocked, the actionTarget's RoomCoords may be different here!")
-        currentPosition = actionTarget.PositionInRoom;
+        qValuesRewards.UpdateQValue(actionToTake, GridTrainingConstants::SimLearningRate, deltaQ);
+        currentPosition = actionTarget;
         ++numActionsTaken;
         if (Get_ActionTargets(GetNavEnvironment(), currentPosition).IsGoalState())
             goalReached = true;
@@ -344,9 +627,9 @@ void ULevelTrainerComponent::SimulateRun(FIntPoint startingStatePosition, int ma
 
 void ULevelTrainerComponent::IncrementGoalPosition()
 {
-    if (CurrentGoalPosition.Y == GetNavEnvironment()[0].Num() - 1)
+    if (CurrentGoalPosition.Y == GetNavEnvironment().NumY() - 1)
     {
-        if (CurrentGoalPosition.X == GetNavEnvironment().Num() - 1)
+        if (CurrentGoalPosition.X == GetNavEnvironment().NumX() - 1)
         {
             LevelTrained = true;
             //return;
@@ -361,7 +644,12 @@ void ULevelTrainerComponent::IncrementGoalPosition()
     {
         ++CurrentGoalPosition.Y;
     }
-    TrainingPosition.Set(CurrentGoalPosition.Y + CurrentGoalPosition.X * GetNavEnvironment()[0].Num());
+    TrainingPosition.Set(CurrentGoalPosition.Y + CurrentGoalPosition.X * GetNavEnvironment().NumY());
+}
+
+int ULevelTrainerComponent::GetNumSimulationsSaved()
+{
+    return NumSimulationsFixedBudget.GetValue() - NumSimulationsRun.GetValue();
 }
 
 float ULevelTrainerComponent::GetTrainingProgress()
@@ -6,6 +6,7 @@
 //#include "Engine/EngineBaseTypes.h"
 //#include "Engine/EngineTypes.h"
 #include "Runnable.h"
+#include "Async/Future.h"
 //#include "MazeActor.h"
 #include "Components/ActorComponent.h"
 #include "TPGameDemoGameState.h"
@@ -13,6 +14,19 @@
 
 class ULevelTrainerComponent;
 
+/* Shared by the game thread and a trainer thread. The trainer checks it between goals (and between rows of starting positions), 
+   so cancelling never has to wait for a whole room to finish. */
+class FTrainingCancellationToken
+{
+public:
+    void Cancel() { bCancelled = true; }
+    bool IsCancelled() const { return bCancelled; }
+private:
+    FThreadSafeBool bCancelled = false;
+};
+
+typedef TSharedRef<FTrainingCancellationToken, ESPMode::ThreadSafe> FTrainingCancellationTokenRef;
+
 //====================================================================================================
 // LevelTrainerRunnable
 //====================================================================================================
@@ -20,7 +34,8 @@ class ULevelTrainerComponent;
 class LevelTrainerRunnable : public FRunnable
 {
 public:
-    LevelTrainerRunnable(ULevelTrainerComponent& trainerComponent);
+    LevelTrainerRunnable(ULevelTrainerComponent& trainerComponent, const FTrainingCancellationTokenRef& cancellationToken, 
+                         const RoomTargetsQValuesRewardsSetsPtr& qValuesRewardsSets);
     ~LevelTrainerRunnable();
     // FRunnable interface.
     virtual bool   Init() override;
@@ -32,18 +47,35 @@ public:
 
     void StartTraining();
     void PauseTraining();
+    /* Becomes ready once Run has returned. Can only be retrieved once. */
+    TFuture<void> GetCompletionFuture();
     FThreadSafeBool IsTraining = false;
 private:
     ULevelTrainerComponent& TrainerComponent;
+    FTrainingCancellationTokenRef CancellationToken;
+    /* The tables pinned for training. The thread writes nothing else. */
+    RoomTargetsQValuesRewardsSetsPtr QValuesRewardsSets;
     FThreadSafeBool ShouldTrain = false;
-	FThreadSafeBool ThreadShouldExit = false;
+    /* The trainer thread sleeps on this while paused. */
     FEvent* WaitEvent;
-    FCriticalSection TrainSection;
+    TPromise<void> CompletionPromise;
 };
 
 //====================================================================================================
 // ULevelTrainerComponent
 //====================================================================================================
+
+/* Simulated runs Q-learning episodes on the trainer thread. Sweep runs synchronous Bellman backups of the whole room on the trainer thread,
+   with the same learning rate and discount. Exact solves the Q values for every goal directly by value iteration, converging to the same
+   fixed point as the learning rule (see GridTrainingConstants::LearningRuleFixedPointScale). */
+UENUM(BlueprintType)
+enum class ETrainingSolverMode : uint8
+{
+    Simulated UMETA (DisplayName = "Simulated"),
+    Sweep     UMETA (DisplayName = "Sweep"),
+    Exact     UMETA (DisplayName = "Exact")
+};
+
 DECLARE_EVENT(ULevelTrainerComponent, LevelTrainedEvent);
 DECLARE_DYNAMIC_DELEGATE(FOnLevelTrained);
 
@@ -58,6 +90,8 @@ public:
 	// Sets default values for this component's properties
 	ULevelTrainerComponent();
     void BeginDestroy() override;
+    bool IsReadyForFinishDestroy() override;
+    void FinishDestroy() override;
     void TickComponent( float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction ) override;
 
     UFUNCTION(BlueprintCallable, Category = "Level Training")
@@ -72,35 +106,99 @@ public:
     UFUNCTION(BlueprintCallable, Category = "Level Training")
     void PauseTraining();
 
+    /* Wakes a paused trainer thread. Unlike StartTraining, this carries on from the current goal without restarting the thread. */
+    UFUNCTION(BlueprintCallable, Category = "Level Training")
+    void ResumeTraining();
+
     UFUNCTION(BlueprintCallable, Category = "Level Training")
     void ResetGoalPosition();
 
+    /* Brings the trained Q values up to date with the last UpdateEnvironmentForLevel, only re-propagating values through the cells 
+       whose moves changed. Returns false if there's nothing to retrain from, in which case the room needs a full StartTraining. 
+       If the trainer thread is still finishing a goal, the retrain happens once it has stopped. A frozen room has already had its
+       policy baked again by UpdateEnvironmentForLevel, so it counts as retrained. */
+    UFUNCTION(BlueprintCallable, Category = "Level Training")
+    bool RetrainChangedEnvironment();
+
     UFUNCTION(BlueprintCallable, Category = "Level Training")
     float GetTrainingProgress();
 
+    /* How many fewer simulations the last simulated training took than a fixed NUM_TRAINING_SIMULATIONS per starting position. Negative for hard rooms. */
+    UFUNCTION(BlueprintCallable, Category = "Level Training")
+    int GetNumSimulationsSaved();
+
     /* These properties need to be set from blueprint around the time of level setup. */
     UPROPERTY(BlueprintReadWrite, Category = "Level Trainer Room Position")
     FIntPoint RoomCoords = FIntPoint(0,0);
 
+    /* Simulated and Sweep train on the trainer thread. Exact solves the whole room on the game thread inside StartTraining. */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Level Training")
+    ETrainingSolverMode SolverMode = ETrainingSolverMode::Simulated;
+
+    /* In Simulated mode, step the simulated runs from each starting position in lockstep batches rather than one at a time. */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Level Training")
+    bool bLockstepSimulatedRuns = false;
+
 private:
     FThreadSafeBool LevelTrained = false;
     TSharedPtr<FRunnableThread> TrainerThread;
 
     TSharedPtr<LevelTrainerRunnable> TrainerRunnable = nullptr;
+    TSharedPtr<FTrainingCancellationToken, ESPMode::ThreadSafe> CancellationToken;
+    TFuture<void> TrainerCompletion;
+    /* A trainer thread that has been cancelled, but may still be finishing its current goal. */
+    struct FRetiredTrainer
+    {
+        TSharedPtr<LevelTrainerRunnable> Runnable;
+        TSharedPtr<FRunnableThread> Thread;
+        TFuture<void> Completion;
+    };
+    /* Joined in TickComponent once they've finished, so the game thread never waits on them. */
+    TArray<FRetiredTrainer> RetiredTrainers;
+    /* StartTraining and RetrainChangedEnvironment calls waiting for RetiredTrainers, since the trainer threads share the payload and kernels. */
+    bool bStartTrainingWhenReleased = false;
+    bool bRetrainWhenReleased = false;
     FCriticalSection ClientSection;
+    /* Pinned on the game thread when training starts, so the room can be disabled while the trainer thread is still using it. */
+    RoomPayloadPtr TrainingPayload;
+    /* The payload's Q tables, pinned for the trainer thread (see RoomPayload::PinForTraining) until it has been joined. */
+    RoomTargetsQValuesRewardsSetsPtr TrainingQValuesRewardsSets;
+    /* Built from the pinned payload when training starts in Sweep mode. */
+    TUniquePtr<BellmanSweepKernel> SweepKernel;
+    /* Built from the pinned payload when training starts in Simulated mode with lockstep runs. */
+    TUniquePtr<LockstepEpisodeKernel> LockstepKernel;
+    /* The room's environment from before the last UpdateEnvironmentForLevel, kept for RetrainChangedEnvironment. */
+    NavigationEnvironment PreviousNavEnvironment;
 
     BehaviourMap GetBehaviourMap();
-    void ClearEnvironment();
+    void ClearEnvironment(RoomTargetsQValuesRewardsSets& qValuesRewardsSets);
 
     const NavigationEnvironment& GetNavEnvironment() const;
     const RoomTargetsQValuesRewardsSets& GetNavSets() const;
     void InitTrainerThread();
-    void TrainNextGoalPosition(int numSimulationsPerStartingPosition, int maxNumActionsPerSimulation);
+    /* Unpins the training payload's tables and lets go of it. Only once no trainer thread is left using them. */
+    void ReleaseTrainingPayload();
+    /* Cancels the trainer thread if it is still running and moves it to RetiredTrainers. Doesn't wait for it to stop. */
+    void ReleaseTrainerThread();
+    /* Joins the retired trainer threads that have finished, or all of them if waitForCompletion is set. Returns true if none are left. */
+    bool JoinRetiredTrainers(bool waitForCompletion);
+    bool IsTrainingCancelled() const { return CancellationToken.IsValid() && CancellationToken->IsCancelled(); }
+    void TrainNextGoalPosition(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, int numSimulationsPerStartingPosition, int maxNumActionsPerSimulation);
     // Simulate a run through the while keepting track of the average deltaQ and the num actions taken. (these will be used to measure convergence)
-    void SimulateRun(FIntPoint startingStatePosition, int maxNumActions, float& averageDeltaQ, int& numActionsTaken);
+    void SimulateRun(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, FIntPoint startingStatePosition, int maxNumActions, float& averageDeltaQ, int& numActionsTaken);
     void IncrementGoalPosition();
+    /* Value iteration over the room graph, swept in backward BFS order from the goal. Writes the optimal Q values for the goal in place. */
+    void SolveGoalPosition(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, FIntPoint goalPosition);
+    void SolveAllGoalPositions();
+    void SweepGoalPosition(RoomTargetsQValuesRewardsSets& qValuesRewardsSets, FIntPoint goalPosition);
+    /* Path distances to the goal (INDEX_NONE if unreachable) for every cell, and the reachable cells in BFS order from the goal. */
+    void GetGoalDistances(FIntPoint goalPosition, TArray<FIntPoint>& outBFSOrder, TArray<int32>& outPathDistances) const;
+    /* The most simulations to run from a starting position. Scales the base budget by how far, and how indirect, the path to the goal is. */
+    int GetSimulationBudget(FIntPoint startPosition, int pathDistance, int maxPathDistance, int baseBudget) const;
     FThreadSafeCounter TrainingPosition = 0;
     FThreadSafeCounter MaxTrainingPosition = 0;
+    FThreadSafeCounter NumSimulationsRun = 0;
+    FThreadSafeCounter NumSimulationsFixedBudget = 0;
     FIntPoint CurrentGoalPosition {0,0};
 
     LevelTrainedEvent OnLevelTrained;
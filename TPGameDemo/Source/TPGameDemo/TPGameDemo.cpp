@@ -23,6 +23,40 @@ FString DirectionHelpers::GetDisplayString(EDirectionType direction)
     }
 }
 
+uint32 CellLayoutHelpers::GetMortonCode(FIntPoint position)
+{
+    // Spreads the low 16 bits of a coordinate out into the even bits.
+    auto spreadBits = [](uint32 value)
+    {
+        value &= 0x0000FFFF;
+        value = (value | (value << 8)) & 0x00FF00FF;
+        value = (value | (value << 4)) & 0x0F0F0F0F;
+        value = (value | (value << 2)) & 0x33333333;
+        value = (value | (value << 1)) & 0x55555555;
+        return value;
+    };
+    return (spreadBits((uint32)position.X) << 1) | spreadBits((uint32)position.Y);
+}
+
+void CellLayoutHelpers::GetLayoutOffsets(int numX, int numY, ECellLayout layout, TArray<int32>& outOffsets)
+{
+    const int numCells = FMath::Max(numX * numY, 0);
+    outOffsets.SetNumUninitialized(numCells);
+    if (layout == ECellLayout::RowMajor)
+    {
+        for (int cell = 0; cell < numCells; ++cell)
+            outOffsets[cell] = cell;
+        return;
+    }
+    TArray<int32> cellsInOrder;
+    cellsInOrder.SetNumUninitialized(numCells);
+    for (int cell = 0; cell < numCells; ++cell)
+        cellsInOrder[cell] = cell;
+    cellsInOrder.Sort([numY](int32 a, int32 b) { return GetMortonCode(FIntPoint(a / numY, a % numY)) < GetMortonCode(FIntPoint(b / numY, b % numY)); });
+    for (int offset = 0; offset < numCells; ++offset)
+        outOffsets[cellsInOrder[offset]] = offset;
+}
+
 FIntPoint LevelBuilderHelpers::GetTargetPointForAction(FIntPoint startingPoint, EDirectionType actionType, int numSpaces /*= 1*/)
 {
     FIntPoint endPoint = startingPoint;
@@ -73,7 +107,8 @@ InnerRoomBitmask LevelBuilderHelpers::ArrayToBitmask(TArray<TArray<int>>& arrayR
         {
             const InnerRoomBitmask cellState = arrayRef[x][y];
             ensure(cellState == 0 || cellState == 1);
-            bitmask |= (cellState << index);
+            // The first cell lands on bit 0 (a shift by the full width is undefined, and x86 wraps it round).
+            bitmask |= (cellState << (index % InnerRoomBitmask_Size));
             --index;
         }
     }
@@ -90,7 +125,7 @@ void LevelBuilderHelpers::BitMaskToArray(InnerRoomBitmask bitmask, TArray<TArray
         ensure(arrayRef[x].Num() == side);
         for (int y = inset; y < side - inset; ++y)
         {
-            const int cellState = (bitmask & ((InnerRoomBitmask)1 << index)) ? (int)ECellState::Closed : (int)ECellState::Open;
+            const int cellState = (bitmask & ((InnerRoomBitmask)1 << (index % InnerRoomBitmask_Size))) ? (int)ECellState::Closed : (int)ECellState::Open;
             arrayRef[x][y] = cellState;
             --index;
         }
@@ -257,27 +292,200 @@ void LevelBuilderHelpers::PrintArray(TArray<TArray<int>>& arrayRef)
 }
 
 //====================================================================================================
-// ActionQValuesAndRewards
+// RoomDistanceField
 //====================================================================================================
 
-const TArray<float> ActionQValuesAndRewards::GetQValues() const
+namespace
+{
+    constexpr uint64 DistanceFieldColumn0 = 0x0101010101010101ull;
+    constexpr uint64 DistanceFieldColumn7 = 0x8080808080808080ull;
+
+    /* One step of wavefront expansion in every direction. Bit (x * 8 + y), with North = +x and East = +y. */
+    uint64 ExpandWavefront(uint64 cells)
+    {
+        return (cells << 8) | (cells >> 8) | ((cells << 1) & ~DistanceFieldColumn0) | ((cells >> 1) & ~DistanceFieldColumn7);
+    }
+};
+
+RoomDistanceField::RoomDistanceField(InnerRoomBitmask innerStructure, const TArray<int>& neswDoorPositions)
+{
+    SetStructure(innerStructure, neswDoorPositions);
+    Layers.Reserve(NumNodes * Side);
+    for (int goal = 0; goal < NumNodes; ++goal)
+        SolveGoal(goal);
+}
+
+RoomDistanceField::RoomDistanceField(InnerRoomBitmask innerStructure, const TArray<int>& neswDoorPositions, FIntPoint goalPosition)
+{
+    SetStructure(innerStructure, neswDoorPositions);
+    const int goal = GetNode(goalPosition);
+    if (goal != INDEX_NONE)
+        SolveGoal(goal);
+}
+
+void RoomDistanceField::SetStructure(InnerRoomBitmask innerStructure, const TArray<int>& neswDoorPositions)
+{
+    static_assert(Side * Side == InnerRoomBitmask_Size, "Distance fields expect a square inner room bitmask.");
+    ensure(neswDoorPositions.Num() == (int)EDirectionType::NumDirectionTypes);
+
+    // InnerRoomBitmask packs cell k into bit (64 - k) % 64. Unpack it into row-major order, and flip closed bits to open ones.
+    OpenCells = 0;
+    for (int cell = 0; cell < NumInnerCells; ++cell)
+    {
+        if (!(innerStructure & ((InnerRoomBitmask)1 << ((InnerRoomBitmask_Size - cell) % InnerRoomBitmask_Size))))
+            OpenCells |= (uint64)1 << cell;
+    }
+
+    for (int d = 0; d < (int)EDirectionType::NumDirectionTypes; ++d)
+    {
+        const int doorPosition = FMath::Clamp(neswDoorPositions[d], 1, Side);
+        ensure(doorPosition == neswDoorPositions[d]);
+        switch ((EDirectionType)d)
+        {
+            case EDirectionType::North: DoorPositions[d] = FIntPoint(Side + 1, doorPosition); break;
+            case EDirectionType::East:  DoorPositions[d] = FIntPoint(doorPosition, Side + 1); break;
+            case EDirectionType::South: DoorPositions[d] = FIntPoint(0, doorPosition); break;
+            case EDirectionType::West:  DoorPositions[d] = FIntPoint(doorPosition, 0); break;
+            default: break;
+        }
+        const FIntPoint innerNeighbour = LevelBuilderHelpers::GetTargetPointForAction(DoorPositions[d], DirectionHelpers::GetOppositeDirection((EDirectionType)d));
+        DoorInnerNeighbours[d] = (innerNeighbour.X - 1) * Side + (innerNeighbour.Y - 1);
+    }
+
+    FMemory::Memset(Distances, Unreachable, sizeof(Distances));
+    FMemory::Memzero(OptimalActionMasks, sizeof(OptimalActionMasks));
+    FMemory::Memzero(LayersStart, sizeof(LayersStart));
+    FMemory::Memzero(NumLayers, sizeof(NumLayers));
+    Layers.Reset();
+}
+
+void RoomDistanceField::SolveGoal(int goal)
+{
+    uint8* distances = Distances[goal];
+    uint64* actionMasks = OptimalActionMasks[goal];
+    LayersStart[goal] = Layers.Num();
+    uint64 frontier = 0;
+    if (goal < NumInnerCells)
+    {
+        frontier = OpenCells & ((uint64)1 << goal);
+    }
+    else
+    {
+        // Door goals sit outside the bitboard. Layer 0 is left empty and the wavefront starts from the door's inner neighbour.
+        const int door = goal - NumInnerCells;
+        distances[goal] = 0;
+        Layers.Add(0);
+        frontier = OpenCells & ((uint64)1 << DoorInnerNeighbours[door]);
+        actionMasks[door] |= frontier;
+    }
+
+    uint64 visited = frontier;
+    while (frontier != 0)
+    {
+        const uint8 distance = (uint8)(Layers.Num() - LayersStart[goal]);
+        if (distance > 0)
+        {
+            const uint64 previous = Layers.Last();
+            actionMasks[(int)EDirectionType::North] |= frontier & (previous >> 8);
+            actionMasks[(int)EDirectionType::South] |= frontier & (previous << 8);
+            actionMasks[(int)EDirectionType::East]  |= frontier & (previous >> 1) & ~DistanceFieldColumn7;
+            actionMasks[(int)EDirectionType::West]  |= frontier & (previous << 1) & ~DistanceFieldColumn0;
+        }
+        Layers.Add(frontier);
+        for (uint64 cells = frontier; cells != 0; cells &= cells - 1)
+            distances[FMath::CountTrailingZeros64(cells)] = distance;
+        frontier = ExpandWavefront(frontier) & OpenCells & ~visited;
+        visited |= frontier;
+    }
+    NumLayers[goal] = Layers.Num() - LayersStart[goal];
+
+    for (int door = 0; door < (int)EDirectionType::NumDirectionTypes; ++door)
+    {
+        const uint8 neighbourDistance = distances[DoorInnerNeighbours[door]];
+        if (NumInnerCells + door != goal && neighbourDistance != Unreachable)
+            distances[NumInnerCells + door] = neighbourDistance + 1;
+    }
+}
+
+int RoomDistanceField::GetNode(FIntPoint position) const
+{
+    if (position.X >= 1 && position.X <= Side && position.Y >= 1 && position.Y <= Side)
+        return (position.X - 1) * Side + (position.Y - 1);
+    for (int door = 0; door < (int)EDirectionType::NumDirectionTypes; ++door)
+    {
+        if (DoorPositions[door] == position)
+            return NumInnerCells + door;
+    }
+    return INDEX_NONE;
+}
+
+uint8 RoomDistanceField::GetDistance(FIntPoint goalPosition, FIntPoint position) const
+{
+    const int goal = GetNode(goalPosition);
+    const int node = GetNode(position);
+    if (goal == INDEX_NONE || node == INDEX_NONE)
+        return Unreachable;
+    return Distances[goal][node];
+}
+
+uint64 RoomDistanceField::GetDistanceLayer(FIntPoint goalPosition, int distance) const
+{
+    const int goal = GetNode(goalPosition);
+    if (goal == INDEX_NONE || distance < 0 || distance >= NumLayers[goal])
+        return 0;
+    return Layers[LayersStart[goal] + distance];
+}
+
+FDirectionSet RoomDistanceField::GetOptimalActions(FIntPoint goalPosition, FIntPoint position) const
+{
+    FDirectionSet directionSet;
+    const int goal = GetNode(goalPosition);
+    const int node = GetNode(position);
+    if (goal == INDEX_NONE || node == INDEX_NONE || node == goal || Distances[goal][node] == Unreachable)
+        return directionSet;
+    if (node >= NumInnerCells)
+    {
+        // Every route out of a door goes through its inner neighbour.
+        directionSet.EnableDirection(DirectionHelpers::GetOppositeDirection((EDirectionType)(node - NumInnerCells)));
+        return directionSet;
+    }
+    for (int d = 0; d < (int)EDirectionType::NumDirectionTypes; ++d)
+    {
+        if (OptimalActionMasks[goal][d] & ((uint64)1 << node))
+            directionSet.EnableDirection((EDirectionType)d);
+    }
+    return directionSet;
+}
+
+BehaviourMap RoomDistanceField::GetBehaviourMap(FIntPoint goalPosition) const
 {
-    return ActionQValues;
+    BehaviourMap behaviourMap;
+    InitialiseBehaviourMap(behaviourMap, Side + 2, Side + 2);
+    for (int x = 0; x < Side + 2; ++x)
+    {
+        for (int y = 0; y < Side + 2; ++y)
+            behaviourMap[x][y] = GetOptimalActions(goalPosition, FIntPoint(x, y));
+    }
+    return behaviourMap;
 }
 
-const TArray<float> ActionQValuesAndRewards::GetRewards() const
+//====================================================================================================
+// ActionQValuesAndRewards
+//====================================================================================================
+
+const float* ActionQValuesAndRewards::GetRewards() const
 {
     return ActionRewards;
 }
 
 const float ActionQValuesAndRewards::GetOptimalQValueAndActions(FDirectionSet& Actions) const
 {
-    ensure(ActionQValues.Num() == (int)EDirectionType::NumDirectionTypes);
-    float optimalQValue = ActionQValues[0] + ActionRewardTrackers[0].GetAverage();
+    ensure(ActionQValues != nullptr);
+    float optimalQValue = GetActionValue((EDirectionType)0);
     Actions.EnableDirection((EDirectionType)0);
-    for (int i = 1; i < ActionQValues.Num(); ++i)
+    for (int i = 1; i < (int)EDirectionType::NumDirectionTypes; ++i)
     {
-        float currentV = ActionQValues[i] + ActionRewardTrackers[i].GetAverage();
+        float currentV = GetActionValue((EDirectionType)i);
         if (currentV >= optimalQValue)
         {
             if (currentV > optimalQValue)
@@ -293,20 +501,20 @@ const float ActionQValuesAndRewards::GetOptimalQValueAndActions(FDirectionSet& A
 
 const float ActionQValuesAndRewards::GetOptimalQValueAndActions_Valid(FDirectionSet& ValidActions) const
 {
-    ensure(ActionQValues.Num() == (int)EDirectionType::NumDirectionTypes);
+    ensure(ActionQValues != nullptr);
     EDirectionType direction = EDirectionType::North;
     FDirectionSet optimalActions;
     optimalActions.Clear();
     while (!ValidActions.CheckDirection(direction))
         direction = (EDirectionType)((int)direction + 1);
-    float optimalQValue = ActionQValues[(int)direction] + ActionRewardTrackers[(int)direction].GetAverage();
+    float optimalQValue = GetActionValue(direction);
     optimalActions.EnableDirection(direction);
     
-    for (int i = (int)direction + 1; i < ActionQValues.Num(); ++i)
+    for (int i = (int)direction + 1; i < (int)EDirectionType::NumDirectionTypes; ++i)
     {
         if (ValidActions.CheckDirection((EDirectionType)i))
         {
-            float currentV = ActionQValues[i] + ActionRewardTrackers[i].GetAverage();
+            float currentV = GetActionValue((EDirectionType)i);
             if (currentV >= optimalQValue)
             {
                 if (currentV > optimalQValue)
@@ -322,11 +530,6 @@ const float ActionQValuesAndRewards::GetOptimalQValueAndActions_Valid(FDirection
     return optimalQValue;
 }
 
-FRoomPositionPair ActionTargets::GetActionTarget(EDirectionType actionType) const
-{
-    return Targets[(int)actionType];
-}
-
 void ActionQValuesAndRewards::ResetQValues()
 {
     for (int actionType = 0; actionType < (int)EDirectionType::NumDirectionTypes; ++actionType)
@@ -335,8 +538,11 @@ void ActionQValuesAndRewards::ResetQValues()
 
 void ActionQValuesAndRewards::UpdateQValue(EDirectionType actionType, float learningRate, float deltaQ)
 {
-    float currentQValue = ActionQValues[(int)actionType];
-    ActionQValues[(int)actionType] = (1.0f - learningRate) * currentQValue + deltaQ;
+    const float updatedQValue = (1.0f - learningRate) * GetQValue(actionType) + deltaQ;
+    if (LearningState != nullptr)
+        LearningState->QValueDeltas[(int)actionType] = updatedQValue - ActionQValues[(int)actionType];
+    else
+        ActionQValues[(int)actionType] = updatedQValue;
 }
 
 bool ActionTargets::IsGoalState() const
@@ -359,10 +565,1852 @@ bool ActionTargets::IsStateValid() const
     return IsValid;
 }
 
-void ActionTargets::SetActionTarget(EDirectionType actionType, FRoomPositionPair roomAndPosition)
+void ActionTargets::SetActionTarget(EDirectionType actionType, FIntPoint wrappedPosition, FIntPoint roomOffset, bool leavesRoom)
+{
+    ensure(wrappedPosition.X >= 0 && wrappedPosition.X <= 0xFF && wrappedPosition.Y >= 0 && wrappedPosition.Y <= 0xFF);
+    ensure(FMath::Abs(roomOffset.X) <= 1 && FMath::Abs(roomOffset.Y) <= 1);
+    const int action = (int)actionType;
+    Targets[action] = (uint16)(wrappedPosition.X | (wrappedPosition.Y << 8));
+    const int shift = action * 4;
+    RoomOffsets = (uint16)((RoomOffsets & ~(0xF << shift)) | (((roomOffset.X & 0x3) | ((roomOffset.Y & 0x3) << 2)) << shift));
+    CrossRoomMask = leavesRoom ? (CrossRoomMask | (1 << action)) : (CrossRoomMask & ~(1 << action));
+}
+
+//====================================================================================================
+// NavigationEnvironment
+//====================================================================================================
+
+NavigationEnvironment::NavigationEnvironment(int numX, int numY, ECellLayout layout /*= ECellLayout::RowMajor*/)
+    : SizeX(numX)
+    , SizeY(numY)
+    , Layout(layout)
+{
+    // Wrapped target positions are stored in a byte per axis.
+    ensure(numX > 1 && numY > 1 && numX - 1 <= 0x100 && numY - 1 <= 0x100);
+    CellLayoutHelpers::GetLayoutOffsets(numX, numY, layout, Offsets);
+    Cells.AddDefaulted(Offsets.Num());
+    ValidActionsMasks.SetNumZeroed(Offsets.Num());
+    for (int x = 0; x < numX; ++x)
+        for (int y = 0; y < numY; ++y)
+            UpdateValidActionsMask(FIntPoint(x, y));
+}
+
+FIntPoint NavigationEnvironment::GetInRoomActionTarget(FIntPoint position, EDirectionType actionType) const
+{
+    const ActionTargets& targets = GetActionTargets(position);
+    if (targets.LeavesRoom(actionType))
+        return position;
+    const FIntPoint roomOffset = targets.GetTargetRoomOffset(actionType);
+    const FIntPoint wrappedPosition = targets.GetWrappedTargetPosition(actionType);
+    return FIntPoint(wrappedPosition.X + roomOffset.X * (SizeX - 1), wrappedPosition.Y + roomOffset.Y * (SizeY - 1));
+}
+
+void NavigationEnvironment::SetActionTarget(FIntPoint position, EDirectionType actionType, FIntPoint targetPosition)
+{
+    // Rooms share their border cells, so the far border belongs to the next room along (see ATPGameDemoGameState::WrapRoomPositionPair).
+    const FIntPoint roomOffset(targetPosition.X / (SizeX - 1) - (targetPosition.X < 0 ? 1 : 0), targetPosition.Y / (SizeY - 1) - (targetPosition.Y < 0 ? 1 : 0));
+    const FIntPoint wrappedPosition(targetPosition.X - roomOffset.X * (SizeX - 1), targetPosition.Y - roomOffset.Y * (SizeY - 1));
+    GetActionTargets(position).SetActionTarget(actionType, wrappedPosition, roomOffset, false);
+    UpdateValidActionsMask(position);
+}
+
+void NavigationEnvironment::SetCrossRoomActionTarget(FIntPoint position, EDirectionType actionType, FIntPoint roomOffset, FIntPoint targetPosition)
+{
+    GetActionTargets(position).SetActionTarget(actionType, targetPosition, roomOffset, true);
+    UpdateValidActionsMask(position);
+}
+
+void NavigationEnvironment::UpdateValidActionsMask(FIntPoint position)
+{
+    const ActionTargets& targets = GetActionTargets(position);
+    uint8 mask = 0;
+    for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+    {
+        if (targets.GetWrappedTargetPosition((EDirectionType)a) != position || targets.GetTargetRoomOffset((EDirectionType)a) != FIntPoint(0, 0))
+            mask |= 1 << a;
+    }
+    ValidActionsMasks[GetOffset(position)] = mask;
+}
+
+void NavigationEnvironment::Empty()
+{
+    SizeX = 0;
+    SizeY = 0;
+    Offsets.Empty();
+    Cells.Empty();
+    ValidActionsMasks.Empty();
+}
+
+//====================================================================================================
+// QValuesRewardsSet
+//====================================================================================================
+
+QValuesRewardsSet::QValuesRewardsSet(float* qValues, const TMap<int32, float>* rewardOverrides, const int32* cellOrdinals, int numStates, int numX, int numY, FIntPoint goalPosition)
+    : QValues(qValues), RewardOverrides(rewardOverrides)
+    , CellOrdinals(cellOrdinals), NumStates(numStates), SizeX(numX), SizeY(numY)
+{
+    GoalOrdinal = GetCellIndex(goalPosition);
+    for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+    {
+        const FIntPoint neighbour = LevelBuilderHelpers::GetTargetPointForAction(goalPosition, DirectionHelpers::GetOppositeDirection((EDirectionType)a));
+        GoalNeighbours[a] = LevelBuilderHelpers::GridPositionIsValid(neighbour, SizeX, SizeY) ? neighbour.X * SizeY + neighbour.Y : INDEX_NONE;
+    }
+}
+
+ActionQValuesAndRewards QValuesRewardsSet::GetActionQValuesAndRewards(FIntPoint position, FRealtimeLearningState* learningState /*= nullptr*/)
+{
+    const int cell = GetCellIndex(position);
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    float rewards[(int)EDirectionType::NumDirectionTypes];
+    for (int a = 0; a < numActions; ++a)
+        rewards[a] = GetActionReward(position.X * SizeY + position.Y, a);
+    return ActionQValuesAndRewards(QValues + cell * numActions, rewards, learningState);
+}
+
+const ActionQValuesAndRewards QValuesRewardsSet::GetActionQValuesAndRewards(FIntPoint position, FRealtimeLearningState* learningState /*= nullptr*/) const
+{
+    return const_cast<QValuesRewardsSet*>(this)->GetActionQValuesAndRewards(position, learningState);
+}
+
+float QValuesRewardsSet::GetImplicitReward(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType)
+{
+    return LevelBuilderHelpers::GetTargetPointForAction(position, actionType) == goalPosition ? GridTrainingConstants::GoalReward : GridTrainingConstants::MovementCost;
+}
+
+float QValuesRewardsSet::GetOverriddenReward(int cell, int action, float implicitReward) const
+{
+    const float* reward = RewardOverrides->Find((GoalOrdinal * NumStates + GetCellIndex(cell)) * (int)EDirectionType::NumDirectionTypes + action);
+    return reward != nullptr ? *reward : implicitReward;
+}
+
+void QValuesRewardsSet::ResetQValues()
+{
+    FMemory::Memzero(QValues, sizeof(float) * NumStates * (int)EDirectionType::NumDirectionTypes);
+}
+
+void QValuesRewardsSet::CopyFrom(const QValuesRewardsSet& other)
+{
+    ensure(other.SizeX == SizeX && other.SizeY == SizeY && other.NumStates == NumStates);
+    // The trainer hands back the set it has been training in place, so this is often a no-op.
+    if (other.QValues == QValues)
+        return;
+    const int numActionValues = NumStates * (int)EDirectionType::NumDirectionTypes;
+    FMemory::Memcpy(QValues, other.QValues, sizeof(float) * numActionValues);
+}
+
+//====================================================================================================
+// FRoomCellIndex
+//====================================================================================================
+
+FRoomCellIndex::FRoomCellIndex(int numX, int numY, ECellLayout layout /*= ECellLayout::RowMajor*/)
+{
+    TArray<bool> liveCells;
+    liveCells.Init(true, FMath::Max(numX * numY, 0));
+    Build(numX, numY, liveCells, layout);
+}
+
+FRoomCellIndex::FRoomCellIndex(const NavigationEnvironment& environment)
+{
+    const int numX = environment.NumX();
+    const int numY = environment.NumY();
+    TArray<bool> liveCells;
+    liveCells.SetNumUninitialized(numX * numY);
+    for (int x = 0; x < numX; ++x)
+        for (int y = 0; y < numY; ++y)
+            liveCells[x * numY + y] = Get_ActionTargets(environment, FIntPoint(x, y)).IsStateValid();
+    Build(numX, numY, liveCells, environment.GetLayout());
+}
+
+FRoomCellIndex::FRoomCellIndex(int numX, int numY, const TArray<bool>& liveCells, ECellLayout layout /*= ECellLayout::RowMajor*/)
+{
+    ensure(liveCells.Num() == numX * numY);
+    Build(numX, numY, liveCells, layout);
+}
+
+void FRoomCellIndex::GetLiveOrdinals(int32* outLiveOrdinals) const
+{
+    for (int cell = 0; cell < Ordinals.Num(); ++cell)
+        outLiveOrdinals[cell] = Cells[Ordinals[cell]] != INDEX_NONE ? Ordinals[cell] : INDEX_NONE;
+}
+
+bool FRoomCellIndex::SetLiveOrdinals(int numX, int numY, const int32* liveOrdinals)
+{
+    const int numCells = FMath::Max(numX * numY, 0);
+    TArray<bool> liveCells;
+    liveCells.SetNumUninitialized(numCells);
+    for (int cell = 0; cell < numCells; ++cell)
+        liveCells[cell] = liveOrdinals[cell] != INDEX_NONE;
+    // Only a numbering Build comes up with is valid.
+    for (ECellLayout layout : { ECellLayout::RowMajor, ECellLayout::Morton })
+    {
+        Build(numX, numY, liveCells, layout);
+        bool valid = numCells > 0;
+        for (int cell = 0; cell < numCells && valid; ++cell)
+            valid = !liveCells[cell] || Ordinals[cell] == liveOrdinals[cell];
+        if (valid)
+            return true;
+    }
+    *this = FRoomCellIndex();
+    return false;
+}
+
+void FRoomCellIndex::Build(int numX, int numY, const TArray<bool>& liveCells, ECellLayout layout)
+{
+    SizeX = numX;
+    SizeY = numY;
+    Layout = layout;
+    TArray<int32> offsets;
+    CellLayoutHelpers::GetLayoutOffsets(numX, numY, layout, offsets);
+    TArray<int32> cellsInOrder;
+    cellsInOrder.SetNumUninitialized(offsets.Num());
+    for (int cell = 0; cell < offsets.Num(); ++cell)
+        cellsInOrder[offsets[cell]] = cell;
+    Ordinals.SetNumUninitialized(liveCells.Num());
+    Cells.Reset();
+    for (int offset = 0; offset < cellsInOrder.Num(); ++offset)
+    {
+        const int cell = cellsInOrder[offset];
+        if (liveCells[cell])
+        {
+            Ordinals[cell] = Cells.Num();
+            Cells.Add(cell);
+        }
+    }
+    const int32 deadOrdinal = Cells.Num();
+    bool anyDeadCells = false;
+    for (int cell = 0; cell < liveCells.Num(); ++cell)
+    {
+        if (!liveCells[cell])
+        {
+            Ordinals[cell] = deadOrdinal;
+            anyDeadCells = true;
+        }
+    }
+    if (anyDeadCells)
+        Cells.Add(INDEX_NONE);
+}
+
+//====================================================================================================
+// RoomTargetsQValuesRewardsSets
+//====================================================================================================
+
+RoomTargetsQValuesRewardsSets::RoomTargetsQValuesRewardsSets(int numX, int numY)
+    : RoomTargetsQValuesRewardsSets(FRoomCellIndex(numX, numY))
+{
+}
+
+RoomTargetsQValuesRewardsSets::RoomTargetsQValuesRewardsSets(const FRoomCellIndex& cellIndex)
+{
+    Allocate(cellIndex);
+    InitialiseValues();
+}
+
+RoomTargetsQValuesRewardsSets::RoomTargetsQValuesRewardsSets(int numX, int numY, const uint8* block)
+{
+    FRoomCellIndex cellIndex;
+    if (!ensure(cellIndex.SetLiveOrdinals(numX, numY, (const int32*)block)))
+        return;
+    Allocate(cellIndex);
+    FMemory::Memcpy(Block, block, BlockSize);
+}
+
+RoomTargetsQValuesRewardsSets::RoomTargetsQValuesRewardsSets(int numX, int numY, const uint8* mappedBlock, const TSharedPtr<FMappedPolicyLibraryFile, ESPMode::ThreadSafe>& mappedFile)
+{
+    FRoomCellIndex cellIndex;
+    if (!ensure(cellIndex.SetLiveOrdinals(numX, numY, (const int32*)mappedBlock)))
+        return;
+    SetLayout(cellIndex);
+    // The mapping is read-only. RoomPayload copies read-only sets before anything writes to them.
+    SetPlanes(const_cast<uint8*>(mappedBlock));
+    MappedFile = mappedFile;
+}
+
+RoomTargetsQValuesRewardsSets::RoomTargetsQValuesRewardsSets(const RoomTargetsQValuesRewardsSets& other)
+{
+    *this = other;
+}
+
+RoomTargetsQValuesRewardsSets::RoomTargetsQValuesRewardsSets(RoomTargetsQValuesRewardsSets&& other)
+{
+    *this = MoveTemp(other);
+}
+
+RoomTargetsQValuesRewardsSets& RoomTargetsQValuesRewardsSets::operator=(const RoomTargetsQValuesRewardsSets& other)
+{
+    if (this != &other)
+    {
+        Release();
+        if (other.IsAllocated())
+        {
+            // Same cell index gives the same layout, so the whole block can be copied in one go.
+            Allocate(other.CellIndex);
+            ensure(BlockSize == other.BlockSize);
+            FMemory::Memcpy(Block, other.Block, BlockSize);
+            RewardOverrides = other.RewardOverrides;
+        }
+    }
+    return *this;
+}
+
+RoomTargetsQValuesRewardsSets& RoomTargetsQValuesRewardsSets::operator=(RoomTargetsQValuesRewardsSets&& other)
+{
+    if (this != &other)
+    {
+        Release();
+        SizeX = other.SizeX;
+        SizeY = other.SizeY;
+        CellIndex = MoveTemp(other.CellIndex);
+        GoalStride = other.GoalStride;
+        BlockSize = other.BlockSize;
+        Block = other.Block;
+        QValues = other.QValues;
+        RewardOverrides = MoveTemp(other.RewardOverrides);
+        MappedFile = MoveTemp(other.MappedFile);
+        other.Block = nullptr;
+        other.Release();
+    }
+    return *this;
+}
+
+RoomTargetsQValuesRewardsSets::~RoomTargetsQValuesRewardsSets()
+{
+    Release();
+}
+
+QValuesRewardsSet RoomTargetsQValuesRewardsSets::GetQValuesRewardsSet(FIntPoint goalPosition)
+{
+    ensure(IsAllocated());
+    const int goal = GetCellOrdinal(goalPosition);
+    return QValuesRewardsSet(QValues + goal * GoalStride, RewardOverrides.Num() > 0 ? &RewardOverrides : nullptr, CellIndex.GetOrdinals(), GetNumStates(), SizeX, SizeY, goalPosition);
+}
+
+const QValuesRewardsSet RoomTargetsQValuesRewardsSets::GetQValuesRewardsSet(FIntPoint goalPosition) const
+{
+    return const_cast<RoomTargetsQValuesRewardsSets*>(this)->GetQValuesRewardsSet(goalPosition);
+}
+
+ActionQValuesAndRewards RoomTargetsQValuesRewardsSets::GetActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position)
+{
+    return GetQValuesRewardsSet(goalPosition).GetActionQValuesAndRewards(position);
+}
+
+const ActionQValuesAndRewards RoomTargetsQValuesRewardsSets::GetActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position) const
+{
+    return const_cast<RoomTargetsQValuesRewardsSets*>(this)->GetActionQValuesAndRewards(goalPosition, position);
+}
+
+SIZE_T RoomTargetsQValuesRewardsSets::GetBlockSize(int numX, int numY, const uint8* block, SIZE_T maxSize)
+{
+    if (numX <= 0 || numY <= 0 || maxSize < sizeof(int32) * numX * numY)
+        return 0;
+    FRoomCellIndex cellIndex;
+    if (!cellIndex.SetLiveOrdinals(numX, numY, (const int32*)block))
+        return 0;
+    RoomTargetsQValuesRewardsSets layout;
+    layout.SetLayout(cellIndex);
+    return layout.BlockSize <= maxSize ? layout.BlockSize : 0;
+}
+
+void RoomTargetsQValuesRewardsSets::Allocate(const FRoomCellIndex& cellIndex)
+{
+    ensure(Block == nullptr);
+    SetLayout(cellIndex);
+    if (BlockSize > 0)
+    {
+        SetPlanes((uint8*)FMemory::Malloc(BlockSize, PLATFORM_CACHE_LINE_SIZE));
+        CellIndex.GetLiveOrdinals((int32*)Block);
+    }
+}
+
+void RoomTargetsQValuesRewardsSets::SetLayout(const FRoomCellIndex& cellIndex)
+{
+    SizeX = cellIndex.NumX();
+    SizeY = cellIndex.NumY();
+    CellIndex = cellIndex;
+    const int numStates = GetNumStates();
+    if (numStates <= 0)
+        return;
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    const SIZE_T cacheLine = PLATFORM_CACHE_LINE_SIZE;
+    GoalStride = Align(numStates * numActions, cacheLine / sizeof(float));
+    BlockSize = GetCellOrdinalsPlaneSize() + GetQValuesPlaneSize();
+}
+
+void RoomTargetsQValuesRewardsSets::SetPlanes(uint8* block)
+{
+    Block = block;
+    QValues = (float*)(Block + GetCellOrdinalsPlaneSize());
+}
+
+void RoomTargetsQValuesRewardsSets::Release()
+{
+    // Mapped blocks belong to the library.
+    if (Block != nullptr && !MappedFile.IsValid())
+        FMemory::Free(Block);
+    MappedFile.Reset();
+    Block = nullptr;
+    QValues = nullptr;
+    RewardOverrides.Empty();
+    BlockSize = 0;
+    GoalStride = 0;
+    SizeX = 0;
+    SizeY = 0;
+    CellIndex = FRoomCellIndex();
+}
+
+void RoomTargetsQValuesRewardsSets::InitialiseValues()
+{
+    if (!IsAllocated())
+        return;
+    FMemory::Memzero(QValues, sizeof(float) * GoalStride * GetNumStates());
+}
+
+void RoomTargetsQValuesRewardsSets::SetRewardOverride(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType, float reward)
+{
+    if (!ensure(IsAllocated() && CellIndex.IsLive(goalPosition) && CellIndex.IsLive(position)))
+        return;
+    RewardOverrides.Add((GetCellOrdinal(goalPosition) * GetNumStates() + GetCellOrdinal(position)) * (int)EDirectionType::NumDirectionTypes + (int)actionType, reward);
+}
+
+//====================================================================================================
+// BellmanSweepKernel
+//====================================================================================================
+
+namespace
+{
+    float VectorHorizontalMax(const VectorRegister& vector)
+    {
+        VectorRegister maxValue = VectorMax(vector, VectorSwizzle(vector, 1, 0, 3, 2));
+        maxValue = VectorMax(maxValue, VectorSwizzle(maxValue, 2, 3, 0, 1));
+        return VectorGetComponent(maxValue, 0);
+    }
+};
+
+BellmanSweepKernel::BellmanSweepKernel(const NavigationEnvironment& environment)
+{
+    SizeX = environment.NumX();
+    SizeY = environment.NumY();
+    CellValues.SetNumZeroed(SizeX * SizeY);
+    ValidCells.Reserve(SizeX * SizeY);
+    Successors.Reserve(SizeX * SizeY * (int)EDirectionType::NumDirectionTypes);
+    CellLayoutHelpers::GetLayoutOffsets(SizeX, SizeY, environment.GetLayout(), CellOffsets);
+    TArray<int32> cellsInOrder;
+    cellsInOrder.SetNumUninitialized(CellOffsets.Num());
+    for (int cell = 0; cell < CellOffsets.Num(); ++cell)
+        cellsInOrder[CellOffsets[cell]] = cell;
+    for (int cell : cellsInOrder)
+    {
+        const FIntPoint position(cell / SizeY, cell % SizeY);
+        if (!Get_ActionTargets(environment, position).IsStateValid())
+            continue;
+        ValidCells.Add(cell);
+        for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+            Successors.Add(environment.GetOffset(Get_InRoomActionTarget(environment, position, (EDirectionType)a)));
+    }
+}
+
+float BellmanSweepKernel::Sweep(QValuesRewardsSet& qValuesRewardsSet, FIntPoint goalPosition, float learningRate, float discountFactor)
+{
+    ensure(qValuesRewardsSet.SizeX == SizeX && qValuesRewardsSet.SizeY == SizeY);
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    const int goalCell = goalPosition.X * SizeY + goalPosition.Y;
+
+    // Cells are 4 floats each within a cache-line-aligned goal plane, so every cell's actions fit in one aligned register.
+    for (int i = 0; i < ValidCells.Num(); ++i)
+    {
+        const int cell = ValidCells[i];
+        CellValues[CellOffsets[cell]] = VectorHorizontalMax(VectorLoadAligned(qValuesRewardsSet.QValues + qValuesRewardsSet.GetCellIndex(cell) * numActions));
+    }
+    // The goal is terminal.
+    CellValues[CellOffsets[goalCell]] = 0.0f;
+
+    const VectorRegister keepRate = VectorSetFloat1(1.0f - learningRate);
+    const VectorRegister learnRate = VectorSetFloat1(learningRate);
+    const VectorRegister discount = VectorSetFloat1(discountFactor);
+    VectorRegister maxDeltaQ = VectorZero();
+    const int32* successors = Successors.GetData();
+    for (int i = 0; i < ValidCells.Num(); ++i, successors += numActions)
+    {
+        const int cell = ValidCells[i];
+        if (cell == goalCell)
+            continue;
+        const int entry = qValuesRewardsSet.GetCellIndex(cell) * numActions;
+        float* cellQValues = qValuesRewardsSet.QValues + entry;
+        const VectorRegister qValues = VectorLoadAligned(cellQValues);
+        const VectorRegister rewards = MakeVectorRegister(qValuesRewardsSet.GetActionReward(cell, 0), qValuesRewardsSet.GetActionReward(cell, 1), 
+                                                          qValuesRewardsSet.GetActionReward(cell, 2), qValuesRewardsSet.GetActionReward(cell, 3));
+        const VectorRegister nextValues = MakeVectorRegister(CellValues[successors[0]], CellValues[successors[1]], CellValues[successors[2]], CellValues[successors[3]]);
+        const VectorRegister targetValues = VectorMultiplyAdd(discount, nextValues, rewards);
+        const VectorRegister updatedQValues = VectorMultiplyAdd(learnRate, VectorSubtract(targetValues, qValues), VectorMultiply(keepRate, qValues));
+        maxDeltaQ = VectorMax(maxDeltaQ, VectorAbs(VectorSubtract(updatedQValues, qValues)));
+        VectorStoreAligned(updatedQValues, cellQValues);
+    }
+    return VectorHorizontalMax(maxDeltaQ);
+}
+
+//====================================================================================================
+// LockstepEpisodeKernel
+//====================================================================================================
+
+namespace
+{
+    /* Picks uniformly among the actions in the mask, the same way FDirectionSet::ChooseDirection does. */
+    int ChooseTiedAction(int tiedActionsMask)
+    {
+        if (!ensure(tiedActionsMask != 0))
+            return 0;
+        const int numTiedActions = FMath::CountBits(tiedActionsMask);
+        int choice = FMath::Min((int)(rand() / (float)RAND_MAX * numTiedActions), numTiedActions - 1);
+        for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+        {
+            if ((tiedActionsMask & (1 << a)) && choice-- == 0)
+                return a;
+        }
+        return 0;
+    }
+};
+
+LockstepEpisodeKernel::LockstepEpisodeKernel(const NavigationEnvironment& environment)
+{
+    SizeX = environment.NumX();
+    SizeY = environment.NumY();
+    Successors.Reserve(SizeX * SizeY * (int)EDirectionType::NumDirectionTypes);
+    for (int x = 0; x < SizeX; ++x)
+    {
+        for (int y = 0; y < SizeY; ++y)
+        {
+            const bool cellValid = Get_ActionTargets(environment, FIntPoint(x, y)).IsStateValid();
+            for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+            {
+                const FIntPoint target = cellValid ? Get_InRoomActionTarget(environment, FIntPoint(x, y), (EDirectionType)a) : FIntPoint(x, y);
+                Successors.Add(target.X * SizeY + target.Y);
+            }
+        }
+    }
+}
+
+void LockstepEpisodeKernel::SimulateRuns(QValuesRewardsSet& qValuesRewardsSet, FIntPoint goalPosition, FIntPoint startPosition, int numEpisodes, int maxNumActions, 
+                                         float learningRate, float discountFactor, float& averageDeltaQ, int& numActionsTaken)
+{
+    ensure(qValuesRewardsSet.SizeX == SizeX && qValuesRewardsSet.SizeY == SizeY);
+    ensure(numEpisodes > 0 && numEpisodes <= NumLanes);
+    static_assert(NumLanes % 4 == 0, "Lanes are transposed 4 at a time.");
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    const int goalCell = goalPosition.X * SizeY + goalPosition.Y;
+    const int startCell = startPosition.X * SizeY + startPosition.Y;
+    float* qValues = qValuesRewardsSet.QValues;
+
+    // Loads the Q values of 4 lanes' cells (stored by ordinal, though lanes walk grid cells) and transposes them, 
+    // so each register holds one action's values for all 4 lanes.
+    auto getLaneActionValues = [&](const int* cells, VectorRegister* outActionValues)
+    {
+        const VectorRegister row0 = VectorLoadAligned(qValues + qValuesRewardsSet.GetCellIndex(cells[0]) * numActions);
+        const VectorRegister row1 = VectorLoadAligned(qValues + qValuesRewardsSet.GetCellIndex(cells[1]) * numActions);
+        const VectorRegister row2 = VectorLoadAligned(qValues + qValuesRewardsSet.GetCellIndex(cells[2]) * numActions);
+        const VectorRegister row3 = VectorLoadAligned(qValues + qValuesRewardsSet.GetCellIndex(cells[3]) * numActions);
+        const VectorRegister low01 = VectorShuffle(row0, row1, 0, 1, 0, 1);
+        const VectorRegister low23 = VectorShuffle(row2, row3, 0, 1, 0, 1);
+        const VectorRegister high01 = VectorShuffle(row0, row1, 2, 3, 2, 3);
+        const VectorRegister high23 = VectorShuffle(row2, row3, 2, 3, 2, 3);
+        outActionValues[0] = VectorShuffle(low01, low23, 0, 2, 0, 2);
+        outActionValues[1] = VectorShuffle(low01, low23, 1, 3, 1, 3);
+        outActionValues[2] = VectorShuffle(high01, high23, 0, 2, 0, 2);
+        outActionValues[3] = VectorShuffle(high01, high23, 1, 3, 1, 3);
+    };
+    auto getLaneMaxValues = [](const VectorRegister* actionValues)
+    {
+        return VectorMax(VectorMax(actionValues[0], actionValues[1]), VectorMax(actionValues[2], actionValues[3]));
+    };
+
+    alignas(16) int laneCells[NumLanes];
+    bool laneActive[NumLanes];
+    for (int lane = 0; lane < NumLanes; ++lane)
+    {
+        laneCells[lane] = startCell;
+        laneActive[lane] = lane < numEpisodes && startCell != goalCell;
+    }
+
+    const VectorRegister learnRate = VectorSetFloat1(learningRate);
+    const VectorRegister discount = VectorSetFloat1(discountFactor);
+    float totalDeltaQ = 0.0f;
+    int totalActionsTaken = 0;
+    int numUpdates = 0;
+    for (int step = 0; step < maxNumActions; ++step)
+    {
+        int numActiveLanes = 0;
+        for (int lane = 0; lane < NumLanes; ++lane)
+            numActiveLanes += laneActive[lane] ? 1 : 0;
+        if (numActiveLanes == 0)
+            break;
+
+        // Greedy actions: a 4-lane argmax per action, then a (random) pick among each lane's tied actions.
+        int actions[NumLanes];
+        alignas(16) int nextCells[NumLanes];
+        for (int lane = 0; lane < NumLanes; lane += 4)
+        {
+            VectorRegister actionValues[(int)EDirectionType::NumDirectionTypes];
+            getLaneActionValues(laneCells + lane, actionValues);
+            const VectorRegister optimalValues = getLaneMaxValues(actionValues);
+            int tiedLanesMasks[(int)EDirectionType::NumDirectionTypes];
+            for (int a = 0; a < numActions; ++a)
+                tiedLanesMasks[a] = VectorMaskBits(VectorCompareEQ(actionValues[a], optimalValues));
+            for (int l = 0; l < 4; ++l)
+            {
+                int tiedActionsMask = 0;
+                for (int a = 0; a < numActions; ++a)
+                    tiedActionsMask |= ((tiedLanesMasks[a] >> l) & 1) << a;
+                actions[lane + l] = laneActive[lane + l] ? ChooseTiedAction(tiedActionsMask) : 0;
+                nextCells[lane + l] = Successors[laneCells[lane + l] * numActions + actions[lane + l]];
+            }
+        }
+
+        alignas(16) float currentQValues[NumLanes];
+        alignas(16) float immediateRewards[NumLanes];
+        alignas(16) float maxNextValues[NumLanes];
+        alignas(16) float deltaQs[NumLanes];
+        int actionIndices[NumLanes];
+        for (int lane = 0; lane < NumLanes; lane += 4)
+        {
+            VectorRegister nextActionValues[(int)EDirectionType::NumDirectionTypes];
+            getLaneActionValues(nextCells + lane, nextActionValues);
+            VectorStoreAligned(getLaneMaxValues(nextActionValues), maxNextValues + lane);
+        }
+        // There's no gather in the vector API, so the taken actions' Q values and rewards are loaded lane by lane.
+        for (int lane = 0; lane < NumLanes; ++lane)
+        {
+            actionIndices[lane] = qValuesRewardsSet.GetCellIndex(laneCells[lane]) * numActions + actions[lane];
+            currentQValues[lane] = qValues[actionIndices[lane]];
+            immediateRewards[lane] = laneActive[lane] ? qValuesRewardsSet.GetActionReward(laneCells[lane], actions[lane]) : 0.0f;
+        }
+
+        // deltaQ = learningRate * (reward + discount * maxNextQ - Q), 4 lanes at a time.
+        for (int lane = 0; lane < NumLanes; lane += 4)
+        {
+            const VectorRegister targetValues = VectorMultiplyAdd(discount, VectorLoadAligned(maxNextValues + lane), VectorLoadAligned(immediateRewards + lane));
+            VectorStoreAligned(VectorMultiply(learnRate, VectorSubtract(targetValues, VectorLoadAligned(currentQValues + lane))), deltaQs + lane);
+        }
+
+        for (int lane = 0; lane < NumLanes; ++lane)
+        {
+            if (!laneActive[lane])
+                continue;
+            // Lanes taking the same action from the same cell worked out the same deltaQ from the same Q values, so the action 
+            // is only updated once. Applying every lane's copy would compound the update. 
+            bool alreadyUpdated = false;
+            for (int earlierLane = 0; earlierLane < lane && !alreadyUpdated; ++earlierLane)
+                alreadyUpdated = laneActive[earlierLane] && actionIndices[earlierLane] == actionIndices[lane];
+            if (!alreadyUpdated)
+            {
+                // Same update as ActionQValuesAndRewards::UpdateQValue.
+                qValues[actionIndices[lane]] = (1.0f - learningRate) * qValues[actionIndices[lane]] + deltaQs[lane];
+                totalDeltaQ += deltaQs[lane];
+                ++numUpdates;
+            }
+            ++totalActionsTaken;
+            laneCells[lane] = nextCells[lane];
+            if (laneCells[lane] == goalCell)
+                laneActive[lane] = false;
+        }
+    }
+    averageDeltaQ = numUpdates > 0 ? totalDeltaQ / (float)numUpdates : 0.0f;
+    numActionsTaken = totalActionsTaken / numEpisodes;
+}
+
+//====================================================================================================
+// PrioritizedSweepRetrainer
+//====================================================================================================
+
+PrioritizedSweepRetrainer::PrioritizedSweepRetrainer(const NavigationEnvironment& previousEnvironment, const NavigationEnvironment& environment)
+{
+    SizeX = environment.NumX();
+    SizeY = environment.NumY();
+    const int numCells = SizeX * SizeY;
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    const bool dimensionsMatch = previousEnvironment.NumX() == SizeX && previousEnvironment.NumY() == SizeY;
+    ValidCells.SetNumZeroed(numCells);
+    ChangedCells.SetNumZeroed(numCells);
+    Successors.SetNumUninitialized(numCells * numActions);
+    TArray<int32> numPredecessors;
+    numPredecessors.SetNumZeroed(numCells);
+    for (int x = 0; x < SizeX; ++x)
+    {
+        for (int y = 0; y < SizeY; ++y)
+        {
+            const int cell = x * SizeY + y;
+            const FIntPoint position(x, y);
+            ValidCells[cell] = Get_ActionTargets(environment, position).IsStateValid();
+            const bool previouslyValid = dimensionsMatch && Get_ActionTargets(previousEnvironment, position).IsStateValid();
+            bool changed = ValidCells[cell] != previouslyValid;
+            for (int a = 0; a < numActions; ++a)
+            {
+                const FIntPoint target = ValidCells[cell] ? Get_InRoomActionTarget(environment, position, (EDirectionType)a) : position;
+                Successors[cell * numActions + a] = target.X * SizeY + target.Y;
+                if (ValidCells[cell] && previouslyValid)
+                    changed |= Get_InRoomActionTarget(previousEnvironment, position, (EDirectionType)a) != target;
+                // Moves into walls lead back to the cell itself, which then counts as its own predecessor.
+                if (ValidCells[cell])
+                    ++numPredecessors[target.X * SizeY + target.Y];
+            }
+            ChangedCells[cell] = changed;
+            NumChangedCells += changed ? 1 : 0;
+        }
+    }
+
+    PredecessorsStart.SetNumUninitialized(numCells + 1);
+    PredecessorsStart[0] = 0;
+    for (int cell = 0; cell < numCells; ++cell)
+        PredecessorsStart[cell + 1] = PredecessorsStart[cell] + numPredecessors[cell];
+    Predecessors.SetNumUninitialized(PredecessorsStart[numCells]);
+    for (int cell = 0; cell < numCells; ++cell)
+    {
+        for (int a = 0; a < numActions && ValidCells[cell]; ++a)
+        {
+            const int target = Successors[cell * numActions + a];
+            Predecessors[PredecessorsStart[target + 1] - numPredecessors[target]--] = cell;
+        }
+    }
+}
+
+int PrioritizedSweepRetrainer::RetrainGoal(QValuesRewardsSet& qValuesRewardsSet, FIntPoint goalPosition, float discountFactor)
+{
+    ensure(qValuesRewardsSet.SizeX == SizeX && qValuesRewardsSet.SizeY == SizeY);
+    const int numCells = SizeX * SizeY;
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    const int goalCell = goalPosition.X * SizeY + goalPosition.Y;
+    float* qValues = qValuesRewardsSet.QValues;
+    if (!ValidCells[goalCell])
+    {
+        qValuesRewardsSet.ResetQValues();
+        return 0;
+    }
+
+    struct FQueuedCell
+    {
+        float Priority;
+        int32 Cell;
+        bool operator<(const FQueuedCell& other) const { return Priority > other.Priority; }
+    };
+    TArray<FQueuedCell> queue;
+    TArray<bool> queued;
+    queued.SetNumZeroed(numCells);
+    TArray<float> cellValues;
+    cellValues.SetNumZeroed(numCells);
+    for (int cell = 0; cell < numCells; ++cell)
+    {
+        const int entry = qValuesRewardsSet.GetCellIndex(cell) * numActions;
+        if (!ValidCells[cell])
+        {
+            // Walls keep zeroed Q values, like a freshly reset set.
+            FMemory::Memzero(qValues + entry, sizeof(float) * numActions);
+            continue;
+        }
+        if (cell == goalCell)
+            continue;
+        float cellValue = qValues[entry];
+        for (int a = 1; a < numActions; ++a)
+            cellValue = FMath::Max(cellValue, qValues[entry + a]);
+        cellValues[cell] = cellValue;
+    }
+
+    // If the goal itself has only just opened up, its old values mean nothing, so every cell has to be backed up.
+    const bool goalChanged = ChangedCells[goalCell];
+    for (int cell = 0; cell < numCells; ++cell)
+    {
+        if (ValidCells[cell] && cell != goalCell && (goalChanged || ChangedCells[cell]))
+        {
+            queue.HeapPush({ MAX_FLT, cell });
+            queued[cell] = true;
+        }
+    }
+
+    int numBackups = 0;
+    const int maxNumBackups = numCells * GridTrainingConstants::ExactSolverMaxSweeps;
+    while (queue.Num() > 0 && numBackups < maxNumBackups)
+    {
+        FQueuedCell queuedCell;
+        queue.HeapPop(queuedCell, false);
+        const int cell = queuedCell.Cell;
+        queued[cell] = false;
+
+        const int entry = qValuesRewardsSet.GetCellIndex(cell) * numActions;
+        float cellValue = -MAX_FLT;
+        for (int a = 0; a < numActions; ++a)
+        {
+            const float qValue = GridTrainingConstants::LearningRuleFixedPointScale * (qValuesRewardsSet.GetActionReward(cell, a) + discountFactor * cellValues[Successors[cell * numActions + a]]);
+            qValues[entry + a] = qValue;
+            cellValue = FMath::Max(cellValue, qValue);
+        }
+        ++numBackups;
+        const float valueChange = FMath::Abs(cellValue - cellValues[cell]);
+        cellValues[cell] = cellValue;
+        if (valueChange <= GridTrainingConstants::ExactSolverTolerance)
+            continue;
+        for (int p = PredecessorsStart[cell]; p < PredecessorsStart[cell + 1]; ++p)
+        {
+            const int predecessor = Predecessors[p];
+            if (predecessor != goalCell && !queued[predecessor])
+            {
+                queue.HeapPush({ GridTrainingConstants::LearningRuleFixedPointScale * discountFactor * valueChange, predecessor });
+                queued[predecessor] = true;
+            }
+        }
+    }
+    return numBackups;
+}
+
+void RoomTargetsQValuesRewardsSets::CopyTransformedFrom(const RoomTargetsQValuesRewardsSets& source, const FRoomSymmetry& symmetry)
+{
+    ensure(source.SizeX == source.SizeY);
+    Release();
+    if (!source.IsAllocated())
+        return;
+    const int sideLength = source.SizeX;
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    // A cell here is live when the cell it transforms to is live in the source.
+    TArray<int32> sourceCells;
+    TArray<bool> liveCells;
+    sourceCells.SetNumUninitialized(sideLength * sideLength);
+    liveCells.SetNumUninitialized(sideLength * sideLength);
+    for (int cell = 0; cell < sourceCells.Num(); ++cell)
+    {
+        const FIntPoint sourcePosition = symmetry.TransformCell(FIntPoint(cell / sideLength, cell % sideLength), sideLength);
+        sourceCells[cell] = sourcePosition.X * sideLength + sourcePosition.Y;
+        liveCells[cell] = source.CellIndex.IsLive(sourcePosition);
+    }
+    Allocate(FRoomCellIndex(sideLength, sideLength, liveCells, source.CellIndex.GetLayout()));
+    // The dead cells' ordinal maps onto the source's, since dead cells only ever transform to dead cells.
+    TArray<int32> sourceOrdinals;
+    sourceOrdinals.SetNumUninitialized(GetNumStates());
+    for (int cell = 0; cell < sourceCells.Num(); ++cell)
+        sourceOrdinals[CellIndex.GetOrdinal(cell)] = source.CellIndex.GetOrdinal(sourceCells[cell]);
+    int sourceActions[(int)EDirectionType::NumDirectionTypes];
+    for (int a = 0; a < numActions; ++a)
+        sourceActions[a] = (int)symmetry.TransformDirection((EDirectionType)a);
+    CopyMappedFrom(source, sourceOrdinals, sourceActions);
+}
+
+void RoomTargetsQValuesRewardsSets::CopyReindexedFrom(const RoomTargetsQValuesRewardsSets& source, const FRoomCellIndex& cellIndex)
+{
+    ensure(source.SizeX == cellIndex.NumX() && source.SizeY == cellIndex.NumY());
+    Release();
+    Allocate(cellIndex);
+    InitialiseValues();
+    if (!source.IsAllocated() || !IsAllocated())
+        return;
+    TArray<int32> sourceOrdinals;
+    sourceOrdinals.Init(INDEX_NONE, GetNumStates());
+    for (int ordinal = 0; ordinal < GetNumStates(); ++ordinal)
+    {
+        const int cell = CellIndex.GetCell(ordinal);
+        if (cell != INDEX_NONE && source.CellIndex.GetCell(source.CellIndex.GetOrdinal(cell)) != INDEX_NONE)
+            sourceOrdinals[ordinal] = source.CellIndex.GetOrdinal(cell);
+    }
+    const int sourceActions[] = { 0, 1, 2, 3 };
+    CopyMappedFrom(source, sourceOrdinals, sourceActions);
+}
+
+void RoomTargetsQValuesRewardsSets::CopyMappedFrom(const RoomTargetsQValuesRewardsSets& source, const TArray<int32>& sourceOrdinals, const int* sourceActions)
+{
+    const int numStates = GetNumStates();
+    const int numSourceStates = source.GetNumStates();
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    for (int goal = 0; goal < numStates; ++goal)
+    {
+        const int sourceGoal = sourceOrdinals[goal];
+        if (sourceGoal == INDEX_NONE)
+            continue;
+        for (int cell = 0; cell < numStates; ++cell)
+        {
+            const int sourceCell = sourceOrdinals[cell];
+            if (sourceCell == INDEX_NONE)
+                continue;
+            for (int a = 0; a < numActions; ++a)
+            {
+                const int entry = cell * numActions + a;
+                const int sourceEntry = sourceCell * numActions + sourceActions[a];
+                QValues[goal * GoalStride + entry] = source.QValues[sourceGoal * source.GoalStride + sourceEntry];
+                if (source.RewardOverrides.Num() > 0)
+                {
+                    if (const float* reward = source.RewardOverrides.Find((sourceGoal * numSourceStates + sourceCell) * numActions + sourceActions[a]))
+                        RewardOverrides.Add((goal * numStates + cell) * numActions + a, *reward);
+                }
+            }
+        }
+    }
+}
+
+#if !UE_BUILD_SHIPPING
+//====================================================================================================
+// CellLayoutBenchmark
+//====================================================================================================
+
+namespace
+{
+    /* 8-way set-associative, evicting the least recently used line of a set, like a typical L1. */
+    class SimulatedCache
+    {
+    public:
+        static constexpr int NumWays = 8;
+
+        SimulatedCache(int numLines) : NumSets(FMath::Max(numLines / NumWays, 1)) { Lines.Init(~0ull, NumSets * NumWays); }
+
+        void Touch(const void* address)
+        {
+            const uint64 line = (uint64)(UPTRINT)address / 64;
+            // Each set is kept in least to most recently used order.
+            uint64* set = Lines.GetData() + (line % NumSets) * NumWays;
+            int way = 0;
+            while (way < NumWays && set[way] != line)
+                ++way;
+            if (way == NumWays)
+            {
+                ++NumMisses;
+                way = 0;
+            }
+            FMemory::Memmove(set + way, set + way + 1, (NumWays - 1 - way) * sizeof(uint64));
+            set[NumWays - 1] = line;
+        }
+
+        int64 NumMisses = 0;
+
+    private:
+        int NumSets;
+        TArray<uint64> Lines;
+    };
+}
+
+void CellLayoutBenchmark::Run(int sideLength, int numSweeps, int numWalkSteps, int numCacheLines, TArray<FCellLayoutBenchmarkResult>& outResults)
+{
+    outResults.Reset();
+    if (sideLength <= 0)
+        return;
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    TArray<TArray<int>> roomStructure;
+    roomStructure.Init(TArray<int>(), sideLength);
+    for (TArray<int>& row : roomStructure)
+        row.Init((int)ECellState::Open, sideLength);
+    const FIntPoint goalPosition(sideLength / 2, sideLength / 2);
+    TArray<int32> walkActions;
+    walkActions.SetNumUninitialized(numWalkSteps);
+    for (int step = 0; step < numWalkSteps; ++step)
+        walkActions[step] = FMath::RandRange(0, numActions - 1);
+
+    for (ECellLayout layout : { ECellLayout::RowMajor, ECellLayout::Morton })
+    {
+        NavigationEnvironment environment;
+        GetNavigationEnvironmentForRoom(roomStructure, FIntPoint(0, 0), environment, layout);
+        const FRoomCellIndex cellIndex(environment);
+        const int numStates = cellIndex.GetNumOrdinals();
+        float* qValues = (float*)FMemory::Malloc(numStates * numActions * sizeof(float), PLATFORM_CACHE_LINE_SIZE);
+        FMemory::Memzero(qValues, numStates * numActions * sizeof(float));
+        QValuesRewardsSet qValuesRewardsSet(qValues, nullptr, cellIndex.GetOrdinals(), numStates, sideLength, sideLength, goalPosition);
+        BellmanSweepKernel sweepKernel(environment);
+
+        FCellLayoutBenchmarkResult result;
+        result.Layout = layout;
+        double startTime = FPlatformTime::Seconds();
+        for (int sweep = 0; sweep < numSweeps; ++sweep)
+            sweepKernel.Sweep(qValuesRewardsSet, goalPosition, GridTrainingConstants::SimLearningRate, GridTrainingConstants::SimDiscountFactor);
+        result.SweepSeconds = FPlatformTime::Seconds() - startTime;
+
+        // The walk reads the same values UpdateQValueRealtime does: the move's Q value, and the best Q value where it leads.
+        // They're summed into a volatile so the reads can't be optimised away.
+        volatile float checksum = 0.0f;
+        startTime = FPlatformTime::Seconds();
+        FIntPoint position(0, 0);
+        for (int step = 0; step < numWalkSteps; ++step)
+        {
+            const EDirectionType action = (EDirectionType)walkActions[step];
+            checksum = checksum + qValuesRewardsSet.GetActionQValuesAndRewards(position).GetQValue(action);
+            position = Get_InRoomActionTarget(environment, position, action);
+            FDirectionSet optimalActions;
+            checksum = checksum + qValuesRewardsSet.GetActionQValuesAndRewards(position).GetOptimalQValueAndActions(optimalActions);
+        }
+        result.WalkSeconds = FPlatformTime::Seconds() - startTime;
+
+        // Replays the Q value reads (and the sweep's cell value gathers) through the simulated cache.
+        TArray<float> cellValues;
+        cellValues.SetNumZeroed(sideLength * sideLength);
+        TArray<int32> cellsInOrder;
+        cellsInOrder.SetNumUninitialized(sideLength * sideLength);
+        for (int cell = 0; cell < sideLength * sideLength; ++cell)
+            cellsInOrder[environment.GetOffset(FIntPoint(cell / sideLength, cell % sideLength))] = cell;
+        SimulatedCache sweepCache(numCacheLines);
+        for (int cell : cellsInOrder)
+        {
+            const FIntPoint cellPosition(cell / sideLength, cell % sideLength);
+            sweepCache.Touch(qValues + cellIndex.GetOrdinal(cellPosition) * numActions);
+            for (int a = 0; a < numActions; ++a)
+                sweepCache.Touch(cellValues.GetData() + environment.GetOffset(Get_InRoomActionTarget(environment, cellPosition, (EDirectionType)a)));
+        }
+        result.SweepMissesPerCell = (float)sweepCache.NumMisses / (float)cellsInOrder.Num();
+        SimulatedCache walkCache(numCacheLines);
+        position = FIntPoint(0, 0);
+        for (int step = 0; step < numWalkSteps; ++step)
+        {
+            walkCache.Touch(qValues + cellIndex.GetOrdinal(position) * numActions);
+            position = Get_InRoomActionTarget(environment, position, (EDirectionType)walkActions[step]);
+            walkCache.Touch(qValues + cellIndex.GetOrdinal(position) * numActions);
+        }
+        result.WalkMissesPerStep = numWalkSteps > 0 ? (float)walkCache.NumMisses / (float)numWalkSteps : 0.0f;
+
+        FMemory::Free(qValues);
+        outResults.Add(result);
+    }
+}
+#endif // !UE_BUILD_SHIPPING
+
+//====================================================================================================
+// FrozenPolicyTable
+//====================================================================================================
+
+FrozenPolicyTable::FrozenPolicyTable(const RoomTargetsQValuesRewardsSets& qValuesRewardsSets, const TArray<uint8>& validActionMasks)
+    : CellIndex(qValuesRewardsSets.GetCellIndex())
+{
+    const int numStates = CellIndex.GetNumOrdinals();
+    ensure(validActionMasks.Num() == CellIndex.NumX() * CellIndex.NumY());
+    PackedMasks.SetNumZeroed((numStates * numStates + 1) / 2);
+    for (int goal = 0; goal < numStates; ++goal)
+    {
+        const int goalCell = CellIndex.GetCell(goal);
+        if (goalCell == INDEX_NONE)
+            continue;
+        const QValuesRewardsSet goalSet = qValuesRewardsSets.GetQValuesRewardsSet(FIntPoint(goalCell / CellIndex.NumY(), goalCell % CellIndex.NumY()));
+        for (int ordinal = 0; ordinal < numStates; ++ordinal)
+        {
+            const int cell = CellIndex.GetCell(ordinal);
+            if (cell == INDEX_NONE)
+                continue;
+            FDirectionSet optimalActions(validActionMasks[cell]);
+            if (!optimalActions.IsValid())
+                continue;
+            goalSet.GetActionQValuesAndRewards(FIntPoint(cell / CellIndex.NumY(), cell % CellIndex.NumY())).GetOptimalQValueAndActions_Valid(optimalActions);
+            const int entry = goal * numStates + ordinal;
+            PackedMasks[entry / 2] |= (optimalActions.DirectionsMask & 0xF) << ((entry % 2) * 4);
+        }
+    }
+}
+
+FrozenPolicyTable::FrozenPolicyTable(const RoomDistanceField& distanceField, const FRoomCellIndex& cellIndex)
+    : CellIndex(cellIndex)
+{
+    const int numStates = CellIndex.GetNumOrdinals();
+    ensure(RoomDistanceField::SupportsRoomDimensions(FIntPoint(CellIndex.NumX(), CellIndex.NumY())));
+    PackedMasks.SetNumZeroed((numStates * numStates + 1) / 2);
+    for (int goal = 0; goal < numStates; ++goal)
+    {
+        const int goalCell = CellIndex.GetCell(goal);
+        if (goalCell == INDEX_NONE)
+            continue;
+        const FIntPoint goalPosition(goalCell / CellIndex.NumY(), goalCell % CellIndex.NumY());
+        for (int ordinal = 0; ordinal < numStates; ++ordinal)
+        {
+            const int cell = CellIndex.GetCell(ordinal);
+            if (cell == INDEX_NONE)
+                continue;
+            const FDirectionSet optimalActions = distanceField.GetOptimalActions(goalPosition, FIntPoint(cell / CellIndex.NumY(), cell % CellIndex.NumY()));
+            const int entry = goal * numStates + ordinal;
+            PackedMasks[entry / 2] |= (optimalActions.DirectionsMask & 0xF) << ((entry % 2) * 4);
+        }
+    }
+}
+
+FDirectionSet FrozenPolicyTable::GetOptimalActions(FIntPoint goalPosition, FIntPoint position) const
+{
+    const int entry = CellIndex.GetOrdinal(goalPosition) * CellIndex.GetNumOrdinals() + CellIndex.GetOrdinal(position);
+    return FDirectionSet((PackedMasks[entry / 2] >> ((entry % 2) * 4)) & 0xF);
+}
+
+//====================================================================================================
+// QuantizedQValuesTable
+//====================================================================================================
+
+QuantizedQValuesTable::QuantizedQValuesTable(const RoomTargetsQValuesRewardsSets& qValuesRewardsSets, EQValueStorageMode storageMode)
+    : StorageMode(storageMode)
+    , CellIndex(qValuesRewardsSets.GetCellIndex())
+{
+    ensure(StorageMode != EQValueStorageMode::Float);
+    const int numStates = CellIndex.GetNumOrdinals();
+    const int numActions = (int)EDirectionType::NumDirectionTypes;
+    if (StorageMode == EQValueStorageMode::Int8)
+    {
+        ByteValues.SetNumUninitialized(numStates * numStates * numActions);
+        GoalRanges.SetNum(numStates);
+    }
+    else
+    {
+        HalfValues.SetNumUninitialized(numStates * numStates * numActions);
+    }
+
+    TArray<float> goalValues;
+    goalValues.SetNumUninitialized(numStates * numActions);
+    for (int goal = 0; goal < numStates; ++goal)
+    {
+        // The dead cells' ordinal is quantized like any other, from the shared entries it stands for.
+        const QValuesRewardsSet goalSet = qValuesRewardsSets.GetQValuesRewardsSet(GetPosition(goal));
+        for (int cell = 0; cell < numStates; ++cell)
+        {
+            const ActionQValuesAndRewards qValuesRewards = goalSet.GetActionQValuesAndRewards(GetPosition(cell));
+            for (int a = 0; a < numActions; ++a)
+                goalValues[cell * numActions + a] = qValuesRewards.GetActionValue((EDirectionType)a);
+        }
+        if (StorageMode == EQValueStorageMode::Int8)
+        {
+            float minValue = goalValues[0];
+            float maxValue = goalValues[0];
+            for (float value : goalValues)
+            {
+                minValue = FMath::Min(minValue, value);
+                maxValue = FMath::Max(maxValue, value);
+            }
+            GoalRanges[goal].Min = minValue;
+            GoalRanges[goal].Step = (maxValue - minValue) / 255.0f;
+        }
+        for (int i = 0; i < goalValues.Num(); ++i)
+            Requantize(goal, goal * numStates * numActions + i, goalValues[i], false);
+    }
+}
+
+float QuantizedQValuesTable::GetQValue(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType) const
+{
+    const int goal = CellIndex.GetOrdinal(goalPosition);
+    return Dequantize(goal, GetEntryIndex(goal, CellIndex.GetOrdinal(position), actionType));
+}
+
+float QuantizedQValuesTable::GetOptimalQValueAndActions_Valid(FIntPoint goalPosition, FIntPoint position, FDirectionSet& ValidActions, const FRealtimeLearningState* learningState /*= nullptr*/) const
+{
+    const int goal = CellIndex.GetOrdinal(goalPosition);
+    const int firstEntry = GetEntryIndex(goal, CellIndex.GetOrdinal(position), EDirectionType::North);
+    // Observed rewards are added to the dequantized values. Without them, bytes rank the same as the values they stand for, so Int8 
+    // rooms compare the bytes and only the optimal one needs dequantizing.
+    float actionValues[(int)EDirectionType::NumDirectionTypes];
+    for (int i = 0; i < (int)EDirectionType::NumDirectionTypes; ++i)
+    {
+        if (learningState != nullptr)
+            actionValues[i] = Dequantize(goal, firstEntry + i) + learningState->RewardTrackers[i].GetAverage();
+        else
+            actionValues[i] = StorageMode == EQValueStorageMode::Int8 ? (float)ByteValues[firstEntry + i] : (float)HalfValues[firstEntry + i];
+    }
+    FDirectionSet optimalActions;
+    optimalActions.Clear();
+    int optimalAction = INDEX_NONE;
+    for (int i = 0; i < (int)EDirectionType::NumDirectionTypes; ++i)
+    {
+        if (!ValidActions.CheckDirection((EDirectionType)i))
+            continue;
+        if (optimalAction == INDEX_NONE || actionValues[i] >= actionValues[optimalAction])
+        {
+            if (optimalAction == INDEX_NONE || actionValues[i] > actionValues[optimalAction])
+            {
+                optimalActions.Clear();
+                optimalAction = i;
+            }
+            optimalActions.EnableDirection((EDirectionType)i);
+        }
+    }
+    ensure(optimalAction != INDEX_NONE);
+    ValidActions = optimalActions;
+    if (optimalAction == INDEX_NONE)
+        return 0.0f;
+    return learningState != nullptr ? actionValues[optimalAction] : Dequantize(goal, firstEntry + optimalAction);
+}
+
+void QuantizedQValuesTable::UpdateQValue(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType, float learningRate, float deltaQ)
+{
+    const int goal = CellIndex.GetOrdinal(goalPosition);
+    const int entry = GetEntryIndex(goal, CellIndex.GetOrdinal(position), actionType);
+    Requantize(goal, entry, (1.0f - learningRate) * Dequantize(goal, entry) + deltaQ, true);
+}
+
+float QuantizedQValuesTable::GetActionReward(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType) const
+{
+    return QValuesRewardsSet::GetImplicitReward(goalPosition, position, actionType);
+}
+
+void QuantizedQValuesTable::DequantizeTo(RoomTargetsQValuesRewardsSets& qValuesRewardsSets) const
+{
+    ensure(qValuesRewardsSets.GetCellIndex() == CellIndex);
+    const int numStates = CellIndex.GetNumOrdinals();
+    for (int goal = 0; goal < numStates; ++goal)
+    {
+        QValuesRewardsSet goalSet = qValuesRewardsSets.GetQValuesRewardsSet(GetPosition(goal));
+        for (int cell = 0; cell < numStates; ++cell)
+        {
+            ActionQValuesAndRewards qValuesRewards = goalSet.GetActionQValuesAndRewards(GetPosition(cell));
+            for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+                qValuesRewards.SetQValue((EDirectionType)a, Dequantize(goal, GetEntryIndex(goal, cell, (EDirectionType)a)));
+        }
+    }
+}
+
+float QuantizedQValuesTable::Dequantize(int goal, int entry) const
+{
+    if (StorageMode == EQValueStorageMode::Half)
+        return HalfValues[entry];
+    const FGoalRange& range = GoalRanges[goal];
+    return range.Min + range.Step * ByteValues[entry];
+}
+
+void QuantizedQValuesTable::Requantize(int goal, int entry, float value, bool roundStochastically)
+{
+    if (StorageMode == EQValueStorageMode::Half)
+    {
+        HalfValues[entry] = FFloat16(value);
+        return;
+    }
+    const FGoalRange& range = GoalRanges[goal];
+    const float steps = range.Step > 0.0f ? FMath::Clamp((value - range.Min) / range.Step, 0.0f, 255.0f) : 0.0f;
+    int32 byteValue = FMath::FloorToInt(steps);
+    const float remainder = steps - byteValue;
+    if (roundStochastically ? FMath::FRand() < remainder : remainder >= 0.5f)
+        ++byteValue;
+    ByteValues[entry] = (uint8)FMath::Min(byteValue, 255);
+}
+
+FIntPoint QuantizedQValuesTable::GetPosition(int ordinal) const
+{
+    int cell = CellIndex.GetCell(ordinal);
+    // Any dead cell will do for the dead cells' ordinal.
+    if (cell == INDEX_NONE)
+        for (cell = 0; CellIndex.GetOrdinal(cell) != ordinal; ++cell) {}
+    return FIntPoint(cell / CellIndex.NumY(), cell % CellIndex.NumY());
+}
+
+//====================================================================================================
+// RealtimeLearningOverlay
+//====================================================================================================
+
+void RealtimeLearningOverlay::ResetQValueDeltas()
+{
+    for (TPair<int32, FRealtimeLearningState>& state : States)
+        FMemory::Memzero(state.Value.QValueDeltas);
+}
+
+bool RealtimeLearningOverlay::HasQValueDeltas() const
+{
+    for (const TPair<int32, FRealtimeLearningState>& state : States)
+    {
+        for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+        {
+            if (state.Value.QValueDeltas[a] != 0.0f)
+                return true;
+        }
+    }
+    return false;
+}
+
+void RealtimeLearningOverlay::FoldQValueDeltasInto(RoomTargetsQValuesRewardsSets& qValuesRewardsSets)
+{
+    const int numCells = RoomDimensions.X * RoomDimensions.Y;
+    const FRoomCellIndex& cellIndex = qValuesRewardsSets.GetCellIndex();
+    for (TPair<int32, FRealtimeLearningState>& state : States)
+    {
+        const int goalCell = state.Key / numCells;
+        const int cell = state.Key % numCells;
+        const FIntPoint goalPosition(goalCell / RoomDimensions.Y, goalCell % RoomDimensions.Y);
+        const FIntPoint position(cell / RoomDimensions.Y, cell % RoomDimensions.Y);
+        // Closed cells all share one entry, so there's nowhere to put what was learned in them.
+        if (cellIndex.IsLive(goalPosition) && cellIndex.IsLive(position))
+        {
+            ActionQValuesAndRewards qValuesRewards = qValuesRewardsSets.GetActionQValuesAndRewards(goalPosition, position);
+            for (int a = 0; a < (int)EDirectionType::NumDirectionTypes; ++a)
+                qValuesRewards.SetQValue((EDirectionType)a, qValuesRewards.GetQValue((EDirectionType)a) + state.Value.QValueDeltas[a]);
+        }
+        FMemory::Memzero(state.Value.QValueDeltas);
+    }
+}
+
+//====================================================================================================
+// RoomPayload
+//====================================================================================================
+
+ActionQValuesAndRewards RoomPayload::GetLearningActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position)
+{
+    return QValuesRewardsSets->GetQValuesRewardsSet(goalPosition).GetActionQValuesAndRewards(position, &RealtimeLearning.FindOrAdd(goalPosition, position));
+}
+
+const ActionQValuesAndRewards RoomPayload::GetLearningActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position) const
+{
+    // The view only writes through a learning state when it's learned through, which the const view can't be.
+    FRealtimeLearningState* learningState = const_cast<FRealtimeLearningState*>(RealtimeLearning.Find(goalPosition, position));
+    return QValuesRewardsSets->GetQValuesRewardsSet(goalPosition).GetActionQValuesAndRewards(position, learningState);
+}
+
+RoomTargetsQValuesRewardsSets& RoomPayload::GetMutableQValuesRewardsSets()
+{
+    if (QuantizedQValues.IsValid())
+    {
+        QValuesRewardsSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>(QuantizedQValues->GetCellIndex());
+        QuantizedQValues->DequantizeTo(*QValuesRewardsSets);
+        QuantizedQValues.Reset();
+    }
+    else if (IsFrozen())
+    {
+        // The tables the policy was compiled from are gone, so there's nothing to carry on learning from.
+        FrozenPolicy.Reset();
+        QValuesRewardsSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>(GetNavCellIndex());
+    }
+    // Pinned tables were made this room's own when they were pinned; the other references are the trainer's.
+    else if (!IsBeingTrained() && (!QValuesRewardsSets.IsUnique() || QValuesRewardsSets->IsReadOnly()))
+        QValuesRewardsSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>(*QValuesRewardsSets);
+    return *QValuesRewardsSets;
+}
+
+void RoomPayload::ShareQValuesRewardsSets(const RoomTargetsQValuesRewardsSetsPtr& sharedSets)
+{
+    ensure(!IsBeingTrained());
+    FrozenPolicy.Reset();
+    QuantizedQValues.Reset();
+    QValuesRewardsSets = sharedSets;
+    // The deltas were learned on top of the old tables.
+    RealtimeLearning.ResetQValueDeltas();
+}
+
+void RoomPayload::ReindexQValuesRewardsSets()
+{
+    ensure(!IsBeingTrained());
+    // Thawing a frozen room already lays out its fresh tables for NavEnvironment.
+    if (!HasFloatQValues())
+        GetMutableQValuesRewardsSets();
+    const FRoomCellIndex navCellIndex = GetNavCellIndex();
+    if (QValuesRewardsSets->GetCellIndex() == navCellIndex)
+        return;
+    // Shared and mapped tables are left as they are for whoever else holds them.
+    RoomTargetsQValuesRewardsSetsPtr reindexedSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>();
+    reindexedSets->CopyReindexedFrom(*QValuesRewardsSets, navCellIndex);
+    QValuesRewardsSets = reindexedSets;
+}
+
+void RoomPayload::FoldRealtimeQValueDeltas()
+{
+    if (!HasFloatQValues() || !QValuesRewardsSets->IsAllocated() || !RealtimeLearning.HasQValueDeltas())
+        return;
+    RealtimeLearning.FoldQValueDeltasInto(GetMutableQValuesRewardsSets());
+}
+
+RoomTargetsQValuesRewardsSetsPtr RoomPayload::PinForTraining()
+{
+    GetMutableQValuesRewardsSets();
+    ++NumTrainingPins;
+    return QValuesRewardsSets;
+}
+
+void RoomPayload::UnpinFromTraining()
+{
+    if (ensure(NumTrainingPins > 0))
+        --NumTrainingPins;
+}
+
+FRoomCellIndex RoomPayload::GetNavCellIndex() const
+{
+    if (NavEnvironment.NumX() == RoomDimensions.X && RoomDimensions.X > 0 && NavEnvironment.NumY() == RoomDimensions.Y)
+        return FRoomCellIndex(NavEnvironment);
+    return FRoomCellIndex(RoomDimensions.X, RoomDimensions.Y, CellLayout);
+}
+
+void RoomPayload::Quantize(TUniquePtr<QuantizedQValuesTable>&& quantizedQValues)
+{
+    ensure(!IsBeingTrained());
+    FrozenPolicy.Reset();
+    QuantizedQValues = MoveTemp(quantizedQValues);
+    QValuesRewardsSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>();
+    // The deltas belong to the dropped tables; FoldRealtimeQValueDeltas keeps them by folding them in first.
+    RealtimeLearning.ResetQValueDeltas();
+}
+
+void RoomPayload::Freeze(TUniquePtr<FrozenPolicyTable>&& frozenPolicy)
+{
+    ensure(!IsBeingTrained());
+    QuantizedQValues.Reset();
+    FrozenPolicy = MoveTemp(frozenPolicy);
+    QValuesRewardsSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>();
+    // The deltas belong to the dropped tables; FoldRealtimeQValueDeltas keeps them by folding them in first.
+    RealtimeLearning.ResetQValueDeltas();
+}
+
+//====================================================================================================
+// FRoomSymmetry
+//====================================================================================================
+
+FRoomSymmetry FRoomSymmetry::FromIndex(int index)
+{
+    // A quarter turn takes North (+X) to East (+Y): (x, y) -> (-y, x). The mirror flips East and West: (x, y) -> (x, -y).
+    const FRoomSymmetry quarterTurn(0, -1, 1, 0);
+    FRoomSymmetry symmetry = index >= 4 ? FRoomSymmetry(1, 0, 0, -1) : FRoomSymmetry();
+    for (int turn = 0; turn < index % 4; ++turn)
+        symmetry = quarterTurn.Compose(symmetry);
+    return symmetry;
+}
+
+int FRoomSymmetry::Canonicalize(const FRoomLayoutKey& layout, FRoomLayoutKey& outCanonical)
+{
+    outCanonical = layout;
+    if (layout.RoomDimensions.X != layout.RoomDimensions.Y)
+        return 0;
+    int canonicalIndex = 0;
+    for (int index = 1; index < NumSymmetries; ++index)
+    {
+        const FRoomLayoutKey transformed = FromIndex(index).TransformLayout(layout);
+        const int doorsOrder = FMemory::Memcmp(transformed.DoorPositions, outCanonical.DoorPositions, sizeof(transformed.DoorPositions));
+        if (transformed.InnerStructure < outCanonical.InnerStructure || (transformed.InnerStructure == outCanonical.InnerStructure && doorsOrder < 0))
+        {
+            outCanonical = transformed;
+            canonicalIndex = index;
+        }
+    }
+    return canonicalIndex;
+}
+
+FRoomSymmetry FRoomSymmetry::Compose(const FRoomSymmetry& other) const
+{
+    return FRoomSymmetry(XX * other.XX + XY * other.YX, XX * other.XY + XY * other.YY,
+                         YX * other.XX + YY * other.YX, YX * other.XY + YY * other.YY);
+}
+
+FIntPoint FRoomSymmetry::TransformCell(FIntPoint cell, int sideLength) const
+{
+    // Doubled coordinates around the centre keep everything integral for even side lengths.
+    const int centre = sideLength - 1;
+    const int x = cell.X * 2 - centre;
+    const int y = cell.Y * 2 - centre;
+    return FIntPoint((XX * x + XY * y + centre) / 2, (YX * x + YY * y + centre) / 2);
+}
+
+EDirectionType FRoomSymmetry::TransformDirection(EDirectionType direction) const
+{
+    const FIntPoint step = LevelBuilderHelpers::GetTargetPointForAction(FIntPoint(0, 0), direction);
+    const FIntPoint transformedStep(XX * step.X + XY * step.Y, YX * step.X + YY * step.Y);
+    if (transformedStep.X != 0)
+        return transformedStep.X > 0 ? EDirectionType::North : EDirectionType::South;
+    return transformedStep.Y > 0 ? EDirectionType::East : EDirectionType::West;
+}
+
+InnerRoomBitmask FRoomSymmetry::TransformInnerStructure(InnerRoomBitmask innerStructure, int innerSideLength) const
+{
+    // Inner cells are unrolled row-major, the first cell on bit 0 and the rest counting down from the top bit (see ArrayToBitmask).
+    InnerRoomBitmask transformed = 0;
+    for (int cell = 0; cell < innerSideLength * innerSideLength; ++cell)
+    {
+        if ((innerStructure & ((InnerRoomBitmask)1 << ((InnerRoomBitmask_Size - cell) % InnerRoomBitmask_Size))) == 0)
+            continue;
+        const FIntPoint target = TransformCell(FIntPoint(cell / innerSideLength, cell % innerSideLength), innerSideLength);
+        const int targetCell = target.X * innerSideLength + target.Y;
+        transformed |= (InnerRoomBitmask)1 << ((InnerRoomBitmask_Size - targetCell) % InnerRoomBitmask_Size);
+    }
+    return transformed;
+}
+
+FRoomLayoutKey FRoomSymmetry::TransformLayout(const FRoomLayoutKey& layout) const
+{
+    const int sideLength = layout.RoomDimensions.X;
+    FRoomLayoutKey transformed = layout;
+    transformed.InnerStructure = TransformInnerStructure(layout.InnerStructure, sideLength - 2);
+    for (int d = 0; d < (int)EDirectionType::NumDirectionTypes; ++d)
+    {
+        // North and south doors are positioned along Y, east and west doors along X.
+        const int doorPosition = layout.DoorPositions[d];
+        const FIntPoint doorCell = (EDirectionType)d == EDirectionType::North ? FIntPoint(sideLength - 1, doorPosition)
+                                 : (EDirectionType)d == EDirectionType::East  ? FIntPoint(doorPosition, sideLength - 1)
+                                 : (EDirectionType)d == EDirectionType::South ? FIntPoint(0, doorPosition)
+                                                                              : FIntPoint(doorPosition, 0);
+        const FIntPoint transformedCell = TransformCell(doorCell, sideLength);
+        const EDirectionType transformedWall = TransformDirection((EDirectionType)d);
+        const bool alongY = transformedWall == EDirectionType::North || transformedWall == EDirectionType::South;
+        transformed.DoorPositions[(int)transformedWall] = alongY ? transformedCell.Y : transformedCell.X;
+    }
+    return transformed;
+}
+
+//====================================================================================================
+// TrainedRoomCache
+//====================================================================================================
+
+RoomTargetsQValuesRewardsSetsPtr TrainedRoomCache::Find(const FRoomLayoutKey& layout)
+{
+    FRoomLayoutKey canonical;
+    const int orientation = FRoomSymmetry::Canonicalize(layout, canonical);
+    FTrainedLayout* trainedLayout = Entries.Find(canonical);
+    if (trainedLayout == nullptr)
+        return RoomTargetsQValuesRewardsSetsPtr();
+    RoomTargetsQValuesRewardsSetsPtr& orientationSets = trainedLayout->Orientations[orientation];
+    for (int s = 0; s < FRoomSymmetry::NumSymmetries && !orientationSets.IsValid(); ++s)
+    {
+        if (!trainedLayout->Orientations[s].IsValid())
+            continue;
+        // Into the canonical layout, then back out to the orientation that was trained.
+        const FRoomSymmetry toTrainedOrientation = FRoomSymmetry::FromIndex(s).Inverse().Compose(FRoomSymmetry::FromIndex(orientation));
+        orientationSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>();
+        orientationSets->CopyTransformedFrom(*trainedLayout->Orientations[s], toTrainedOrientation);
+    }
+    return orientationSets;
+}
+
+void TrainedRoomCache::Add(const FRoomLayoutKey& layout, const RoomTargetsQValuesRewardsSetsPtr& trainedSets)
+{
+    if (!trainedSets.IsValid() || !trainedSets->IsAllocated())
+        return;
+    FRoomLayoutKey canonical;
+    const int orientation = FRoomSymmetry::Canonicalize(layout, canonical);
+    Entries.FindOrAdd(canonical).Orientations[orientation] = trainedSets;
+}
+
+void TrainedRoomCache::GetCanonicalTrainedLayouts(TArray<TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>>& outTrainedLayouts)
+{
+    TArray<FRoomLayoutKey> canonicalLayouts;
+    Entries.GetKeys(canonicalLayouts);
+    outTrainedLayouts.Reset(canonicalLayouts.Num());
+    for (const FRoomLayoutKey& canonicalLayout : canonicalLayouts)
+        outTrainedLayouts.Add(TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>(canonicalLayout, Find(canonicalLayout)));
+}
+
+void TrainedRoomCache::Remove(const FRoomLayoutKey& layout)
+{
+    FRoomLayoutKey canonical;
+    FRoomSymmetry::Canonicalize(layout, canonical);
+    Entries.Remove(canonical);
+}
+
+//====================================================================================================
+// TrainedRoomDatabase
+//====================================================================================================
+
+TrainedRoomDatabase::TrainedRoomDatabase(const FString& directory, int64 maxSizeBytes)
+    : Directory(directory), MaxSizeBytes(maxSizeBytes)
+{}
+
+TrainedRoomDatabase::~TrainedRoomDatabase()
+{
+    for (TFuture<void>& pendingSave : PendingSaves)
+        pendingSave.Wait();
+}
+
+FString TrainedRoomDatabase::GetFilePath(const FRoomLayoutKey& canonicalLayout) const
+{
+    // Only the inner structure is spelled out in the name; the doors and size go in as a hash, so the header gets checked on load.
+    return Directory + FString::Printf(TEXT("%016llX-%08X.qroom"), canonicalLayout.InnerStructure, GetTypeHash(canonicalLayout));
+}
+
+RoomTargetsQValuesRewardsSetsPtr TrainedRoomDatabase::Load(const FRoomLayoutKey& canonicalLayout)
+{
+    const FString filePath = GetFilePath(canonicalLayout);
+    TArray<uint8> fileData;
+    {
+        FScopeLock lock(&DirectorySection);
+        if (!IFileManager::Get().FileExists(*filePath) || !FFileHelper::LoadFileToArray(fileData, *filePath))
+            return nullptr;
+        // Touch the file so that eviction sees it as recently used.
+        IFileManager::Get().SetTimeStamp(*filePath, FDateTime::UtcNow());
+    }
+
+    const FIntPoint& roomDimensions = canonicalLayout.RoomDimensions;
+    FFileHeader header;
+    bool fileValid = fileData.Num() >= (int32)sizeof(FFileHeader);
+    if (fileValid)
+    {
+        FMemory::Memcpy(&header, fileData.GetData(), sizeof(FFileHeader));
+        fileValid = header.Magic == FileMagic && header.Version == FileVersion && header.CacheLineSize == PLATFORM_CACHE_LINE_SIZE
+                 && header.Layout == canonicalLayout && fileData.Num() == sizeof(FFileHeader) + header.BlockSize
+                 && FCrc::MemCrc32(fileData.GetData() + sizeof(FFileHeader), (int32)header.BlockSize) == header.Checksum
+                 && header.BlockSize == RoomTargetsQValuesRewardsSets::GetBlockSize(roomDimensions.X, roomDimensions.Y, fileData.GetData() + sizeof(FFileHeader), header.BlockSize);
+    }
+    if (!fileValid)
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Deleting trained room file %s, it failed its version or integrity checks."), *filePath);
+        FScopeLock lock(&DirectorySection);
+        IFileManager::Get().Delete(*filePath);
+        return nullptr;
+    }
+    RoomTargetsQValuesRewardsSetsPtr trainedSets = MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>(roomDimensions.X, roomDimensions.Y, fileData.GetData() + sizeof(FFileHeader));
+    SavedLayouts.Add(canonicalLayout);
+    return trainedSets;
+}
+
+void TrainedRoomDatabase::SaveAsync(const FRoomLayoutKey& layout, const RoomTargetsQValuesRewardsSetsPtr& trainedSets)
+{
+    if (!trainedSets.IsValid() || !trainedSets->IsAllocated())
+        return;
+    FRoomLayoutKey canonicalLayout;
+    const int orientation = FRoomSymmetry::Canonicalize(layout, canonicalLayout);
+    if (SavedLayouts.Contains(canonicalLayout))
+        return;
+    SavedLayouts.Add(canonicalLayout);
+    PendingSaves.RemoveAll([](const TFuture<void>& pendingSave) { return pendingSave.IsReady(); });
+    // The sets are shared, so rooms that keep learning copy them rather than write under the save.
+    PendingSaves.Add(Async(EAsyncExecution::ThreadPool, [this, canonicalLayout, orientation, trainedSets]()
+    {
+        Save(canonicalLayout, orientation, trainedSets);
+    }));
+}
+
+void TrainedRoomDatabase::Save(const FRoomLayoutKey& canonicalLayout, int orientation, const RoomTargetsQValuesRewardsSetsPtr& trainedSets)
+{
+    // Files hold the canonical orientation, so every rotation and reflection of the layout finds the same file.
+    RoomTargetsQValuesRewardsSets transformedSets;
+    const RoomTargetsQValuesRewardsSets* canonicalSets = trainedSets.Get();
+    if (orientation != 0)
+    {
+        transformedSets.CopyTransformedFrom(*trainedSets, FRoomSymmetry::FromIndex(orientation).Inverse());
+        canonicalSets = &transformedSets;
+    }
+
+    FFileHeader header;
+    header.Magic = FileMagic;
+    header.Version = FileVersion;
+    header.CacheLineSize = PLATFORM_CACHE_LINE_SIZE;
+    header.BlockSize = canonicalSets->GetAllocatedSize();
+    header.Checksum = FCrc::MemCrc32(canonicalSets->GetBlockData(), (int32)header.BlockSize);
+    header.Layout = canonicalLayout;
+    TArray<uint8> fileData;
+    fileData.SetNumUninitialized(sizeof(FFileHeader) + header.BlockSize);
+    FMemory::Memcpy(fileData.GetData(), &header, sizeof(FFileHeader));
+    FMemory::Memcpy(fileData.GetData() + sizeof(FFileHeader), canonicalSets->GetBlockData(), header.BlockSize);
+
+    // Written under a temporary name and moved into place, so a load never sees half a file.
+    const FString filePath = GetFilePath(canonicalLayout);
+    const FString tempFilePath = filePath + TEXT(".tmp");
+    const bool written = FFileHelper::SaveArrayToFile(fileData, *tempFilePath);
+    FScopeLock lock(&DirectorySection);
+    if (written && IFileManager::Get().Move(*filePath, *tempFilePath))
+        EvictToSizeLimit();
+    else
+        IFileManager::Get().Delete(*tempFilePath);
+}
+
+void TrainedRoomDatabase::EvictToSizeLimit()
+{
+    struct FSavedFile
+    {
+        FString Path;
+        int64 Size;
+        FDateTime TimeStamp;
+    };
+    TArray<FString> fileNames;
+    IFileManager::Get().FindFiles(fileNames, *(Directory + TEXT("*.qroom")), true, false);
+    TArray<FSavedFile> savedFiles;
+    int64 totalSize = 0;
+    for (const FString& fileName : fileNames)
+    {
+        const FString path = Directory + fileName;
+        savedFiles.Add({ path, IFileManager::Get().FileSize(*path), IFileManager::Get().GetTimeStamp(*path) });
+        totalSize += savedFiles.Last().Size;
+    }
+    if (totalSize <= MaxSizeBytes)
+        return;
+    // Least recently used first.
+    savedFiles.Sort([](const FSavedFile& a, const FSavedFile& b) { return a.TimeStamp < b.TimeStamp; });
+    for (int i = 0; i < savedFiles.Num() && totalSize > MaxSizeBytes; ++i)
+    {
+        if (IFileManager::Get().Delete(*savedFiles[i].Path))
+            totalSize -= savedFiles[i].Size;
+    }
+}
+
+//====================================================================================================
+// SharedPolicyLibrary
+//====================================================================================================
+
+void SharedPolicyLibrary::FindGenerations(const FString& directory, TArray<int32>& outGenerations)
+{
+    const FString prefix = TEXT("SharedPolicyLibrary.");
+    const FString extension = TEXT(".qlib");
+    TArray<FString> fileNames;
+    IFileManager::Get().FindFiles(fileNames, *(directory + prefix + TEXT("*") + extension), true, false);
+    outGenerations.Reset();
+    for (const FString& fileName : fileNames)
+    {
+        const FString generation = fileName.Mid(prefix.Len(), fileName.Len() - prefix.Len() - extension.Len());
+        if (generation.IsNumeric())
+            outGenerations.Add(FCString::Atoi(*generation));
+    }
+    outGenerations.Sort();
+}
+
+FString SharedPolicyLibrary::GetGenerationPath(const FString& directory, int32 generation)
+{
+    return directory + FString::Printf(TEXT("SharedPolicyLibrary.%d.qlib"), generation);
+}
+
+bool SharedPolicyLibrary::Open(const FString& directory)
+{
+    TArray<int32> generations;
+    FindGenerations(directory, generations);
+    if (generations.Num() == 0)
+        return false;
+    const FString libraryPath = GetGenerationPath(directory, generations.Last());
+    TSharedPtr<FMappedPolicyLibraryFile, ESPMode::ThreadSafe> mappedFile = MakeShared<FMappedPolicyLibraryFile, ESPMode::ThreadSafe>();
+    mappedFile->Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*libraryPath));
+    if (!mappedFile->Handle.IsValid())
+        return false;
+    mappedFile->Region.Reset(mappedFile->Handle->MapRegion());
+    if (!mappedFile->Region.IsValid())
+        return false;
+
+    const uint8* data = mappedFile->Region->GetMappedPtr();
+    const uint64 size = (uint64)mappedFile->Region->GetMappedSize();
+    if (size < sizeof(FLibraryHeader))
+        return false;
+    const FLibraryHeader* header = (const FLibraryHeader*)data;
+    if (header->Magic != FileMagic || header->Version != FileVersion || header->CacheLineSize != PLATFORM_CACHE_LINE_SIZE
+        || size < sizeof(FLibraryHeader) + sizeof(FLibraryEntry) * header->NumEntries)
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Ignoring policy library %s, it doesn't match this version."), *libraryPath);
+        return false;
+    }
+
+    Entries = (const FLibraryEntry*)(data + sizeof(FLibraryHeader));
+    EntryStates.Init(EEntryState::Unchecked, header->NumEntries);
+    EntryIndices.Reset();
+    for (uint32 e = 0; e < header->NumEntries; ++e)
+    {
+        const FLibraryEntry& entry = Entries[e];
+        // Block sizes depend on the cell index stored in the block, so they're checked along with the checksum in Find.
+        if (entry.Offset % BlockAlignment == 0 && entry.BlockSize > 0 && entry.Offset + entry.BlockSize <= size)
+            EntryIndices.Add(entry.Layout, e);
+    }
+    MappedFile = mappedFile;
+    return true;
+}
+
+RoomTargetsQValuesRewardsSetsPtr SharedPolicyLibrary::Find(const FRoomLayoutKey& canonicalLayout)
+{
+    const int32* entryIndex = EntryIndices.Find(canonicalLayout);
+    if (entryIndex == nullptr)
+        return nullptr;
+    const FLibraryEntry& entry = Entries[*entryIndex];
+    const uint8* block = MappedFile->Region->GetMappedPtr() + entry.Offset;
+    if (EntryStates[*entryIndex] == EEntryState::Unchecked)
+    {
+        const bool valid = FCrc::MemCrc32(block, (int32)entry.BlockSize) == entry.Checksum
+                        && entry.BlockSize == RoomTargetsQValuesRewardsSets::GetBlockSize(entry.Layout.RoomDimensions.X, entry.Layout.RoomDimensions.Y, block, entry.BlockSize);
+        EntryStates[*entryIndex] = valid ? EEntryState::Valid : EEntryState::Invalid;
+    }
+    if (EntryStates[*entryIndex] == EEntryState::Invalid)
+        return nullptr;
+    return MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>(entry.Layout.RoomDimensions.X, entry.Layout.RoomDimensions.Y, block, MappedFile);
+}
+
+bool SharedPolicyLibrary::Write(const FString& directory, const TArray<TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>>& trainedLayouts)
+{
+    TArray<FLibraryEntry> entries;
+    uint64 offset = Align(sizeof(FLibraryHeader) + sizeof(FLibraryEntry) * trainedLayouts.Num(), BlockAlignment);
+    for (const TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>& trainedLayout : trainedLayouts)
+    {
+        const RoomTargetsQValuesRewardsSetsPtr& trainedSets = trainedLayout.Value;
+        if (!trainedSets.IsValid() || !trainedSets->IsAllocated())
+            continue;
+        FLibraryEntry entry;
+        FMemory::Memzero(entry);
+        entry.Layout = trainedLayout.Key;
+        entry.Offset = offset;
+        entry.BlockSize = trainedSets->GetAllocatedSize();
+        entry.Checksum = FCrc::MemCrc32(trainedSets->GetBlockData(), (int32)entry.BlockSize);
+        entries.Add(entry);
+        offset = Align(offset + entry.BlockSize, BlockAlignment);
+    }
+    FLibraryHeader header;
+    header.Magic = FileMagic;
+    header.Version = FileVersion;
+    header.CacheLineSize = PLATFORM_CACHE_LINE_SIZE;
+    header.NumEntries = entries.Num();
+
+    // Older generations may be mapped by other instances, or by this one, so the library never goes over them. It's written under 
+    // a temporary name and moved into place, so instances opening it never see half a file.
+    TArray<int32> generations;
+    FindGenerations(directory, generations);
+    const FString libraryPath = GetGenerationPath(directory, generations.Num() > 0 ? generations.Last() + 1 : 0);
+    const FString tempLibraryPath = libraryPath + TEXT(".tmp");
+    TUniquePtr<IFileHandle> file(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*tempLibraryPath));
+    if (!file.IsValid())
+        return false;
+    TArray<uint8> padding;
+    padding.SetNumZeroed(BlockAlignment);
+    bool written = file->Write((const uint8*)&header, sizeof(FLibraryHeader)) && file->Write((const uint8*)entries.GetData(), sizeof(FLibraryEntry) * entries.Num());
+    int entryIndex = 0;
+    for (const TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>& trainedLayout : trainedLayouts)
+    {
+        if (!written || entryIndex == entries.Num())
+            break;
+        const RoomTargetsQValuesRewardsSetsPtr& trainedSets = trainedLayout.Value;
+        if (!trainedSets.IsValid() || !trainedSets->IsAllocated())
+            continue;
+        const FLibraryEntry& entry = entries[entryIndex++];
+        written = file->Write(padding.GetData(), entry.Offset - file->Tell()) && file->Write(trainedSets->GetBlockData(), entry.BlockSize);
+    }
+    file.Reset();
+    if (!written)
+    {
+        IFileManager::Get().Delete(*tempLibraryPath);
+        return false;
+    }
+    if (!IFileManager::Get().Move(*libraryPath, *tempLibraryPath))
+        return false;
+    // Deleting a mapped file fails on some platforms; elsewhere the instances mapping it keep their pages until they unmap it.
+    for (int32 generation : generations)
+        IFileManager::Get().Delete(*GetGenerationPath(directory, generation));
+    return true;
+}
+
+//====================================================================================================
+// FBuildableRegistry
+//====================================================================================================
+
+bool FBuildableRegistry::IsPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction) const
+{
+    const TMap<int32, EBuildableActorType>* roomPlacements = Rooms.Find(roomAndPosition.RoomCoords);
+    return roomPlacements != nullptr && roomPlacements->Contains(GetPlacementKey(roomAndPosition.PositionInRoom, direction));
+}
+
+void FBuildableRegistry::Place(FRoomPositionPair roomAndPosition, EDirectionType direction, EBuildableActorType type)
+{
+    TMap<int32, EBuildableActorType>& roomPlacements = Rooms.FindOrAdd(roomAndPosition.RoomCoords);
+    const int32 placementKey = GetPlacementKey(roomAndPosition.PositionInRoom, direction);
+    if (!roomPlacements.Contains(placementKey))
+        ++NumPlacements;
+    roomPlacements.Add(placementKey, type);
+}
+
+void FBuildableRegistry::Remove(FRoomPositionPair roomAndPosition, EDirectionType direction)
+{
+    TMap<int32, EBuildableActorType>* roomPlacements = Rooms.Find(roomAndPosition.RoomCoords);
+    if (roomPlacements == nullptr)
+        return;
+    NumPlacements -= roomPlacements->Remove(GetPlacementKey(roomAndPosition.PositionInRoom, direction));
+    if (roomPlacements->Num() == 0)
+        Rooms.Remove(roomAndPosition.RoomCoords);
+}
+
+void FBuildableRegistry::GetPlacementsInRoom(FIntPoint roomCoords, TArray<FBuildablePlacement>& outPlacements, EBuildableActorType type /*= EBuildableActorType::None*/) const
+{
+    outPlacements.Reset();
+    const TMap<int32, EBuildableActorType>* roomPlacements = Rooms.Find(roomCoords);
+    if (roomPlacements == nullptr)
+        return;
+    for (const TPair<int32, EBuildableActorType>& placement : *roomPlacements)
+    {
+        if (type == EBuildableActorType::None || placement.Value == type)
+            outPlacements.Add(GetPlacement(placement.Key, placement.Value));
+    }
+}
+
+void FBuildableRegistry::Empty()
+{
+    Rooms.Empty();
+    NumPlacements = 0;
+}
+
+int32 FBuildableRegistry::GetPlacementKey(FIntPoint positionInRoom, EDirectionType direction)
+{
+    ensure(positionInRoom.X >= 0 && positionInRoom.X < (1 << 14) && positionInRoom.Y >= 0 && positionInRoom.Y < (1 << 14));
+    return (positionInRoom.X << 16) | (positionInRoom.Y << 2) | (int32)direction;
+}
+
+FBuildablePlacement FBuildableRegistry::GetPlacement(int32 placementKey, EBuildableActorType type)
 {
-    ensure(Targets.Num() == (int)EDirectionType::NumDirectionTypes);
-    Targets[(int)actionType] = roomAndPosition;
+    FBuildablePlacement placement;
+    placement.PositionInRoom = FIntPoint(placementKey >> 16, (placementKey >> 2) & ((1 << 14) - 1));
+    placement.Direction = (EDirectionType)(placementKey & 3);
+    placement.Type = type;
+    return placement;
 }
 
 //====================================================================================================
@@ -371,4 +2419,6 @@ void ActionTargets::SetActionTarget(EDirectionType actionType, FRoomPositionPair
 void RoomState::DisableRoom()
 {
     RoomStatus = RoomState::Status::Dead;
+    // Only drops this reference; a trainer that is still working on the room keeps the payload alive until it finishes.
+    Payload.Reset();
 }
\ No newline at end of file
@@ -2,9 +2,9 @@
 
 #pragma once
 
-#include <set>
 #include <climits>
 #include "Engine.h"
+#include "Async/Async.h"
 #include "Runtime/Launch/Resources/Version.h"
 #include "TPGameDemo.generated.h"
 
@@ -17,7 +17,11 @@
 #define CONVERGENCE_NUM_ACTIONS_MIN 100
 #define CONVERGENCE_NUM_ACTIONS_MAX 300
 #define NUM_TRAINING_SIMULATIONS 50
+#define MIN_NUM_TRAINING_SIMULATIONS 8
+#define MAX_NUM_TRAINING_SIMULATIONS 150
+#define CONVERGENCE_NUM_CHECKS 3
 #define MAX_NUM_MOVEMENTS_PER_SIMULATION 100
+#define TRAINED_ROOM_DATABASE_MAX_MB 256
 
 UENUM(BlueprintType)
 enum class EDirectionType : uint8
@@ -39,18 +43,71 @@ enum class EQuadrantType : uint8
     NumQuadrants
 };
 
+UENUM(BlueprintType)
+enum class EBuildableActorType : uint8
+{
+    None    UMETA (DisplayName = "None"),
+    Turret  UMETA (DisplayName = "Turret"),
+    Mine    UMETA (DisplayName = "Mine"),
+    NumBuildables
+};
+
+/* How a trained room keeps its Q values. Float is the full tables the trainers work on. Half and Int8 keep just the values the argmax 
+   ranks, as fp16 or as bytes scaled to each goal's value range. */
+UENUM(BlueprintType)
+enum class EQValueStorageMode : uint8
+{
+    Float UMETA (DisplayName = "Float"),
+    Half  UMETA (DisplayName = "Half"),
+    Int8  UMETA (DisplayName = "Int8")
+};
+
+/* The order a room's cells are stored in, in its navigation environment and its Q tables. RowMajor keeps a cell's East and West 
+   neighbours next to it but puts North and South a whole row away. Morton (Z-order) keeps all four nearby, which pays off in bigger rooms. */
+UENUM(BlueprintType)
+enum class ECellLayout : uint8
+{
+    RowMajor UMETA (DisplayName = "Row Major"),
+    Morton   UMETA (DisplayName = "Morton")
+};
+
 namespace DirectionHelpers
 {
     EDirectionType GetOppositeDirection(EDirectionType direction);
     FString GetDisplayString(EDirectionType direction);
 };
 
+namespace CellLayoutHelpers
+{
+    /* Interleaves the bits of the position, X in the odd bits and Y in the even ones. */
+    uint32 GetMortonCode(FIntPoint position);
+    /* Where each cell of a numX by numY room goes in the layout, indexed row-major. Morton offsets are ranks rather than codes, 
+       so rooms that aren't a power of two on a side don't leave gaps. */
+    void GetLayoutOffsets(int numX, int numY, ECellLayout layout, TArray<int32>& outOffsets);
+};
+
 namespace Delimiters
 {
     const FString DirectionSetStringDelimiter = " ";
     const FString ActionDelimiter = "_";
 };
 
+/* Lookups on the 4-bit direction masks, so FDirectionSet never has to loop or allocate. */
+namespace DirectionMaskTables
+{
+    constexpr uint8 AllDirectionsMask = 0xF;
+    constexpr uint8 NumDirections[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    /* NthDirection[mask][n] is the n'th enabled direction in the mask, in North, East, South, West order. */
+    constexpr uint8 NthDirection[16][4] = 
+    {
+        { 4, 4, 4, 4 }, { 0, 4, 4, 4 }, { 1, 4, 4, 4 }, { 0, 1, 4, 4 },
+        { 2, 4, 4, 4 }, { 0, 2, 4, 4 }, { 1, 2, 4, 4 }, { 0, 1, 2, 4 },
+        { 3, 4, 4, 4 }, { 0, 3, 4, 4 }, { 1, 3, 4, 4 }, { 0, 1, 3, 4 },
+        { 2, 3, 4, 4 }, { 0, 2, 3, 4 }, { 1, 2, 3, 4 }, { 0, 1, 2, 3 }
+    };
+};
+
+/* A set of directions stored as a bitmask, one bit per EDirectionType. */
 USTRUCT(BlueprintType)
 struct FDirectionSet
 {
@@ -66,61 +123,53 @@ struct FDirectionSet
         NumDirectionFlags = 1 << 4
     };
 
-    FDirectionSet()
-    {
-        DirectionSelectionSet.clear();
-    }
+    FDirectionSet() = default;
 
-    FDirectionSet(uint8 directionsMask) : DirectionsMask(directionsMask) 
-    {
-        UpdateSelectionSet();
-    }
+    FDirectionSet(uint8 directionsMask) : DirectionsMask(directionsMask) {}
 
-    EDirectionType ChooseDirection() 
+    EDirectionType ChooseDirection() const
     {
         if (!IsValid())
             return EDirectionType::NumDirectionTypes;
 
+        const uint8 mask = DirectionsMask & DirectionMaskTables::AllDirectionsMask;
+        const int numDirections = DirectionMaskTables::NumDirections[mask];
         float r = rand() / (float)RAND_MAX;
-        int choice = r == 1.0f ? DirectionSelectionSet.size() - 1 : (int)(r * DirectionSelectionSet.size());
-        std::set<EDirectionType>::iterator it = DirectionSelectionSet.begin();
-        advance(it, choice);
-        ensure((int)*it >= (int)EDirectionType::North && (int)*it < (int)EDirectionType::NumDirectionTypes);
-        return *it;
+        int choice = r == 1.0f ? numDirections - 1 : (int)(r * numDirections);
+        return (EDirectionType)DirectionMaskTables::NthDirection[mask][choice];
     }
 
-    bool IsValid() { return DirectionsMask & ((uint8)pow(2, (int)EDirectionType::NumDirectionTypes) - 1); }
+    bool IsValid() const { return DirectionsMask & DirectionMaskTables::AllDirectionsMask; }
 
-    bool CheckDirection(EDirectionType direction) { return DirectionsMask & (1 << (int)direction); }
+    int Num() const { return DirectionMaskTables::NumDirections[DirectionsMask & DirectionMaskTables::AllDirectionsMask]; }
+
+    bool CheckDirection(EDirectionType direction) const { return DirectionsMask & (1 << (int)direction); }
     
-    void Clear()
-    {
-        DirectionsMask = 0;
-        DirectionSelectionSet.clear();
-    }
+    void Clear() { DirectionsMask = 0; }
 
+    /* Out of range directions (e.g. the -1 written for empty sets) are ignored. */
     void EnableDirection(EDirectionType direction) 
     { 
-        DirectionsMask |= (1 << (int)direction);
-        DirectionSelectionSet.insert(direction);
+        if ((int)direction < (int)EDirectionType::NumDirectionTypes)
+            DirectionsMask |= (1 << (int)direction);
     }
     void DisableDirection(EDirectionType direction) 
     { 
-        DirectionsMask &= (~(1 << (int)direction));
-        DirectionSelectionSet.erase(direction);
+        if ((int)direction < (int)EDirectionType::NumDirectionTypes)
+            DirectionsMask &= (~(1 << (int)direction));
     }
 
     /** return a copy if all directions are valid. */
-    FDirectionSet GetInverse()
+    FDirectionSet GetInverse() const
     {
-        if (DirectionSelectionSet.size() == (int)EDirectionType::NumDirectionTypes)
+        if (Num() == (int)EDirectionType::NumDirectionTypes)
         {
             return FDirectionSet(DirectionsMask);
         }
-        return FDirectionSet(~DirectionsMask);
+        return FDirectionSet(~DirectionsMask & DirectionMaskTables::AllDirectionsMask);
     }
 
-    FString ToString(bool padSpaces = false) 
+    FString ToString(bool padSpaces = false) const
     {
         if (!IsValid())
             return FString("-1");
@@ -140,18 +189,11 @@ struct FDirectionSet
     }
 
     uint8 DirectionsMask = 0;
-    std::set<EDirectionType> DirectionSelectionSet;
-
-private:
-    void UpdateSelectionSet()
-    {
-        DirectionSelectionSet.clear();
-        for (int d = 0; d < (int)EDirectionType::NumDirectionTypes; ++d)
-            if (CheckDirection((EDirectionType)d))
-                DirectionSelectionSet.insert((EDirectionType)d);
-    }
 };
 
+static_assert(std::is_trivially_copyable<FDirectionSet>::value && sizeof(FDirectionSet) == 1, "Direction sets are passed around by value on the hot paths.");
+static_assert((int)EDirectionType::NumDirectionTypes == 4, "The direction mask tables assume four directions.");
+
 USTRUCT(Blueprintable)
 struct FRoomPositionPair
 {
@@ -162,6 +204,28 @@ struct FRoomPositionPair
         FIntPoint PositionInRoom;
 };
 
+/* A cell of the world packed into one integer, for the queries enemies make every step. The low 16 bits are the wrapped position in the room, 
+   X | Y << 8 as ActionTargets stores its targets, and the high 16 bits are the room's indices in the game state's room grid, packed the same way. 
+   The cell an action leads to is then just the target plus the room offset, with no wrapping or room index conversions. 
+   Made by ATPGameDemoGameState::GetWorldCellId, which knows the world's dimensions. */
+struct FWorldCellId
+{
+    FWorldCellId() {}
+    FWorldCellId(FIntPoint roomIndices, FIntPoint positionInRoom)
+        : Id((uint32)positionInRoom.X | ((uint32)positionInRoom.Y << 8) | ((uint32)roomIndices.X << 16) | ((uint32)roomIndices.Y << 24)) {}
+
+    FIntPoint GetRoomIndices() const { return FIntPoint((Id >> 16) & 0xFF, Id >> 24); }
+    FIntPoint GetPositionInRoom() const { return FIntPoint(Id & 0xFF, (Id >> 8) & 0xFF); }
+    bool IsValid() const { return Id != InvalidId; }
+
+    bool operator==(const FWorldCellId& other) const { return Id == other.Id; }
+    bool operator!=(const FWorldCellId& other) const { return Id != other.Id; }
+    friend uint32 GetTypeHash(const FWorldCellId& cell) { return cell.Id; }
+
+    static constexpr uint32 InvalidId = MAX_uint32;
+    uint32 Id = InvalidId;
+};
+
 UENUM(BlueprintType)
 enum class EDoorState : uint8
 {
@@ -320,6 +384,58 @@ namespace LevelBuilderHelpers
     void PrintArray(TArray<TArray<int>>& arrayRef);
 };
 
+//====================================================================================================
+// RoomDistanceField
+//====================================================================================================
+
+/* Shortest-path distances from every goal to every cell in a room, built by bitboard wavefront expansion straight from the 
+   InnerRoomBitmask. Nodes are the 8x8 inner cells plus the four door cells on the border. Positions are room positions (border included),
+   the same as in NavigationEnvironment. Cheap enough to derive policies and reachability for many rooms up front. 
+   An 8x8 interior is all an InnerRoomBitmask holds, so only 10x10 rooms have a distance field (see SupportsRoomDimensions). */
+class RoomDistanceField
+{
+public:
+    static constexpr int Side = 8;
+    static constexpr int NumInnerCells = Side * Side;
+    static constexpr int NumNodes = NumInnerCells + (int)EDirectionType::NumDirectionTypes;
+    static constexpr uint8 Unreachable = 0xFF;
+
+    /* Room dimensions include the border. */
+    static bool SupportsRoomDimensions(FIntPoint roomDimensions) { return roomDimensions.X == Side + 2 && roomDimensions.Y == Side + 2; }
+
+    RoomDistanceField(InnerRoomBitmask innerStructure, const TArray<int>& neswDoorPositions);
+    /* Only solves for the one goal, for when that's all that will be asked about. Every other goal is unreachable from everywhere. */
+    RoomDistanceField(InnerRoomBitmask innerStructure, const TArray<int>& neswDoorPositions, FIntPoint goalPosition);
+
+    /* Returns Unreachable if either position is a wall or can't be reached. */
+    uint8 GetDistance(FIntPoint goalPosition, FIntPoint position) const;
+    /* Inner cells at the given distance from the goal, as a bitboard with bit (x * 8 + y) for inner cell (x, y). */
+    uint64 GetDistanceLayer(FIntPoint goalPosition, int distance) const;
+    /* The actions that move one step closer to the goal. Empty at the goal and at cells that can't reach it. */
+    FDirectionSet GetOptimalActions(FIntPoint goalPosition, FIntPoint position) const;
+    BehaviourMap GetBehaviourMap(FIntPoint goalPosition) const;
+
+    uint64 GetOpenCells() const { return OpenCells; }
+
+private:
+    int GetNode(FIntPoint position) const;
+    /* Unpacks the structure, leaving every goal unsolved. */
+    void SetStructure(InnerRoomBitmask innerStructure, const TArray<int>& neswDoorPositions);
+    void SolveGoal(int goal);
+
+    uint64 OpenCells = 0;
+    FIntPoint DoorPositions[(int)EDirectionType::NumDirectionTypes];
+    int DoorInnerNeighbours[(int)EDirectionType::NumDirectionTypes];
+    /* Indexed [goal][node]. */
+    uint8 Distances[NumNodes][NumNodes];
+    /* Indexed [goal][direction]. Bitboards of the inner cells for which moving in that direction is optimal. */
+    uint64 OptimalActionMasks[NumNodes][(int)EDirectionType::NumDirectionTypes];
+    /* Wavefront layers for all goals, back to back. */
+    TArray<uint64> Layers;
+    int LayersStart[NumNodes];
+    int NumLayers[NumNodes];
+};
+
 //====================================================================================================
 // ActionQValuesAndRewards State
 //====================================================================================================
@@ -337,33 +453,104 @@ namespace GridTrainingConstants
     /* The chances of exploration from a certain position for a certain target will get smaller and smaller until this many explorations have been carried out, 
     at which point exploration will never occur.*/
     static const float ExploreCount = 100.0f;
+    /* ActionQValuesAndRewards::UpdateQValue applies Q = (1 - learningRate) * Q + learningRate * (reward + discount * max Q' - Q), whose fixed 
+       point is Q = (reward + discount * max Q') / 2 whatever the learning rate. The exact and retraining solvers scale their backups by this, 
+       so every trainer (and realtime learning) ends up with Q values on the same scale. */
+    static const float LearningRuleFixedPointScale = 0.5f;
+    /* The exact and sweep solvers stop sweeping a goal once no Q value changes by more than this. */
+    static const float ExactSolverTolerance = 1e-5f;
+    static const int ExactSolverMaxSweeps = 512;
 };
 
-/* Action targets for actions taken from a given position. Action targets are FIntPoint positions. Actions are North, East, South, West. */
+/* Action targets for actions taken from a given position. Actions are North, East, South, West.
+   Targets are stored already wrapped (as in ATPGameDemoGameState::WrapRoomPositionPair), as a position in the room that owns the 
+   target cell and that room's offset from this one, so following an action never needs any wrapping math. 
+   Targets are set through the NavigationEnvironment, which knows the room's size. */
 class ActionTargets
 {
 public:
     void SetIsGoal(bool isGoal);
     bool IsGoalState() const;
 
-    FRoomPositionPair GetActionTarget(EDirectionType actionType) const;
+    /* The wrapped target of the action, for a cell in the room at roomCoords. */
+    FRoomPositionPair GetActionTarget(FIntPoint roomCoords, EDirectionType actionType) const
+    {
+        return { roomCoords + GetTargetRoomOffset(actionType), GetWrappedTargetPosition(actionType) };
+    }
+    FIntPoint GetWrappedTargetPosition(EDirectionType actionType) const 
+    { 
+        const uint16 target = Targets[(int)actionType];
+        return FIntPoint(target & 0xFF, target >> 8); 
+    }
+    /* Each of -1, 0 or 1. */
+    FIntPoint GetTargetRoomOffset(EDirectionType actionType) const
+    {
+        const int offsetBits = RoomOffsets >> ((int)actionType * 4);
+        return FIntPoint(((offsetBits & 0x3) ^ 0x2) - 0x2, (((offsetBits >> 2) & 0x3) ^ 0x2) - 0x2);
+    }
+    /* Whether the action goes through an open door into another room's cells. */
+    bool LeavesRoom(EDirectionType actionType) const { return CrossRoomMask & (1 << (int)actionType); }
 
     void SetValid(bool valid);
     bool IsStateValid() const;
 
-    void SetActionTarget(EDirectionType actionType, FRoomPositionPair roomAndPosition);
+    void SetActionTarget(EDirectionType actionType, FIntPoint wrappedPosition, FIntPoint roomOffset, bool leavesRoom);
 
 private:
     bool IsGoal = false;
     bool IsValid = true;
-    
-    TArray<FRoomPositionPair> Targets{ {{0,0},{0,0}}, {{0,0},{0,0}}, {{0,0},{0,0}}, {{0,0},{0,0}} };
+    uint8 CrossRoomMask = 0;
+    /* 4 bits per action: the target room's X then Y offset, as 2 bit two's complement. */
+    uint16 RoomOffsets = 0;
+    /* Wrapped target positions, X | Y << 8. */
+    uint16 Targets[(int)EDirectionType::NumDirectionTypes] = { 0, 0, 0, 0 };
 };
 
-/* QLearning qvalues and rewards for actions taken from a position in a room (for a specific target). Actions are North, East, South, West. */
-class ActionQValuesAndRewards
+/* Action targets for each position in a room. The cells are stored flat in the room's ECellLayout order, so they're looked up by position. */
+class NavigationEnvironment
 {
 public:
+    NavigationEnvironment() {}
+    /* Every cell starts out with default (valid) action targets. */
+    NavigationEnvironment(int numX, int numY, ECellLayout layout = ECellLayout::RowMajor);
+
+    /* Both are zero until the environment has been built. */
+    int NumX() const { return SizeX; }
+    int NumY() const { return SizeY; }
+    ECellLayout GetLayout() const { return Layout; }
+    /* Where a cell is stored, from 0 to NumX() * NumY(). */
+    int GetOffset(FIntPoint position) const { return Offsets[position.X * SizeY + position.Y]; }
+    const ActionTargets& GetActionTargets(FIntPoint position) const { return Cells[GetOffset(position)]; }
+    ActionTargets& GetActionTargets(FIntPoint position) { return Cells[GetOffset(position)]; }
+    /* Where an action leads within the room. Room Q tables only cover their own room, so moving through an open door into the 
+       neighbouring room is treated like walking into a wall; the move from a door cell back into the room is not. Targets on the far 
+       border are given unwrapped, in this room's coordinates. */
+    FIntPoint GetInRoomActionTarget(FIntPoint position, EDirectionType actionType) const;
+    /* Sets the target of a move within the room. targetPosition can be on the border, and is wrapped into the room that owns it. */
+    void SetActionTarget(FIntPoint position, EDirectionType actionType, FIntPoint targetPosition);
+    /* Patches in the target of a door: a position in the neighbouring room at roomOffset. */
+    void SetCrossRoomActionTarget(FIntPoint position, EDirectionType actionType, FIntPoint roomOffset, FIntPoint targetPosition);
+    /* An FDirectionSet mask of the actions that lead somewhere other than the cell itself. Kept up to date by the action target setters. */
+    uint8 GetValidActionsMask(FIntPoint position) const { return ValidActionsMasks[GetOffset(position)]; }
+    void Empty();
+
+private:
+    int SizeX = 0;
+    int SizeY = 0;
+    ECellLayout Layout = ECellLayout::RowMajor;
+    /* CellLayoutHelpers::GetLayoutOffsets. */
+    TArray<int32> Offsets;
+    TArray<ActionTargets> Cells;
+    /* A byte per cell, stored like Cells. */
+    TArray<uint8> ValidActionsMasks;
+
+    void UpdateValidActionsMask(FIntPoint position);
+};
+
+/* What enemies have learned about moving from one cell towards one goal while the game runs: the rewards they've observed, how far 
+   they've moved the trained Q values and how often they've explored. Only states enemies visit get one, in a RealtimeLearningOverlay. */
+struct FRealtimeLearningState
+{
     struct RewardTracker
     {
         float GetAverage() const
@@ -390,119 +577,268 @@ public:
         float AverageReward = 0.0f;
     };
 
-    const TArray<float> GetQValues() const;
-    const TArray<float> GetRewards() const;
+    RewardTracker RewardTrackers[(int)EDirectionType::NumDirectionTypes];
+    float QValueDeltas[(int)EDirectionType::NumDirectionTypes] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float NumExplorations = (float)NUM_TRAINING_SIMULATIONS;
+};
+
+/* QLearning qvalues and rewards for actions taken from a position in a room (for a specific target). Actions are North, East, South, West.
+   This is a view into a RoomTargetsQValuesRewardsSets arena. It doesn't own any memory, so it is cheap to pass around by value. 
+   Views made for realtime learning also see the state's FRealtimeLearningState, and learning through them only writes to that. */
+class ActionQValuesAndRewards
+{
+public:
+    /* Rewards aren't stored in the arena, so the view keeps its own copy of the ones worked out for it. learningState can be null. */
+    ActionQValuesAndRewards(float* qValues, const float* rewards, FRealtimeLearningState* learningState = nullptr)
+        : ActionQValues(qValues), LearningState(learningState)
+    {
+        FMemory::Memcpy(ActionRewards, rewards, sizeof(ActionRewards));
+    }
+
+    /* The trained Q value, plus whatever realtime learning has added to it. */
+    float GetQValue(EDirectionType actionType) const { return ActionQValues[(int)actionType] + (LearningState != nullptr ? LearningState->QValueDeltas[(int)actionType] : 0.0f); }
+    /* Indexed by EDirectionType. See QValuesRewardsSet::GetActionReward. */
+    const float* GetRewards() const;
 
     const float GetOptimalQValueAndActions(FDirectionSet& Actions) const;
 
     const float GetOptimalQValueAndActions_Valid(FDirectionSet& Actions) const;
+    /* The Q value plus the action's average observed reward. The optimal actions are the ones with the highest. */
+    float GetActionValue(EDirectionType actionType) const { return GetQValue(actionType) + (LearningState != nullptr ? LearningState->RewardTrackers[(int)actionType].GetAverage() : 0.0f); }
 
+    /* Writes the trained Q value, or the realtime learning state's delta if the view has one. */
     void UpdateQValue(EDirectionType actionType, float learningRate, float deltaQ);
+    /* These two only write the trained Q values. */
+    void SetQValue(EDirectionType actionType, float qValue) { ActionQValues[(int)actionType] = qValue; }
     void ResetQValues();
 
-    void SetActionReward(EDirectionType movementDirection, float reward)
+    /* These need a realtime learning state. */
+    void AddActionRewardObservation(EDirectionType action, float reward)
     {
-        ActionRewards[(int)movementDirection] = reward;
+        if (ensure(LearningState != nullptr))
+            LearningState->RewardTrackers[(int)action].AddObservation(reward);
     }
 
-    void SetAsGoal()
-    {
-        ActionRewards = { GridTrainingConstants::GoalReward, GridTrainingConstants::GoalReward,
-                          GridTrainingConstants::GoalReward, GridTrainingConstants::GoalReward };
+    void IncrementExplorations() 
+    { 
+        if (ensure(LearningState != nullptr))
+            ++LearningState->NumExplorations; 
     }
+    float GetExploreProbability() const 
+    { 
+        const float numExplorations = LearningState != nullptr ? LearningState->NumExplorations : (float)NUM_TRAINING_SIMULATIONS;
+        return FMath::Clamp(1.0f - (numExplorations / GridTrainingConstants::ExploreCount), 0.0f, 1.0f); 
+    }
+private:
+    float* ActionQValues;
+    float ActionRewards[(int)EDirectionType::NumDirectionTypes];
+    FRealtimeLearningState* LearningState;
+};
 
-    void AddActionRewardObservation(EDirectionType action, float reward)
+/* ActionQValuesAndRewards for each position in a room (for a fixed target position). 
+   This is a view onto one goal's slice of a RoomTargetsQValuesRewardsSets arena, indexed [cell][action]. */
+class QValuesRewardsSet
+{
+public:
+    QValuesRewardsSet(float* qValues, const TMap<int32, float>* rewardOverrides, const int32* cellOrdinals, int numStates, int numX, int numY, FIntPoint goalPosition);
+
+    int NumX() const { return SizeX; }
+    int NumY() const { return SizeY; }
+
+    ActionQValuesAndRewards GetActionQValuesAndRewards(FIntPoint position, FRealtimeLearningState* learningState = nullptr);
+    const ActionQValuesAndRewards GetActionQValuesAndRewards(FIntPoint position, FRealtimeLearningState* learningState = nullptr) const;
+
+    /* Moving onto the goal gets the goal reward, every other move costs the movement cost. */
+    static float GetImplicitReward(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType);
+    /* The implicit reward, unless the arena overrides it. */
+    float GetActionReward(FIntPoint position, EDirectionType actionType) const { return GetActionReward(position.X * SizeY + position.Y, (int)actionType); }
+
+    void ResetQValues();
+    /* Copies all values from another set of the same dimensions. */
+    void CopyFrom(const QValuesRewardsSet& other);
+
+private:
+    friend class BellmanSweepKernel;
+    friend class LockstepEpisodeKernel;
+    friend class PrioritizedSweepRetrainer;
+
+    /* Entries are indexed by the cell's ordinal in the arena's FRoomCellIndex, not by the cell itself. */
+    int GetCellIndex(FIntPoint position) const { return CellOrdinals[position.X * SizeY + position.Y]; }
+    int GetCellIndex(int cell) const { return CellOrdinals[cell]; }
+    /* Takes the cell row-major, the way the kernels walk the room. */
+    float GetActionReward(int cell, int action) const
     {
-        ActionRewardTrackers[(int)action].AddObservation(reward);
+        const float reward = cell == GoalNeighbours[action] ? GridTrainingConstants::GoalReward : GridTrainingConstants::MovementCost;
+        return RewardOverrides == nullptr ? reward : GetOverriddenReward(cell, action, reward);
     }
+    float GetOverriddenReward(int cell, int action, float implicitReward) const;
+
+    float* QValues;
+    /* Null unless the arena has reward overrides. Keyed like the arena's Q values, [goal][cell][action]. */
+    const TMap<int32, float>* RewardOverrides;
+    const int32* CellOrdinals;
+    int NumStates;
+    int SizeX;
+    int SizeY;
+    int GoalOrdinal;
+    /* The cell each action has to be taken from to move onto the goal, or INDEX_NONE if that's outside the room. */
+    int32 GoalNeighbours[(int)EDirectionType::NumDirectionTypes];
+};
+
+/* Dense ordinals for the cells of a room that can hold a state (open cells and doors), so that Q tables only need entries for those.
+   All the dead cells (walls, and the border away from the doors) share one extra ordinal at the end. Nothing meaningful is stored 
+   there, but lookups of dead cells can land on it without any checks. */
+class FRoomCellIndex
+{
+public:
+    FRoomCellIndex() {}
+    /* Every cell is live. For rooms whose structure isn't known yet. */
+    FRoomCellIndex(int numX, int numY, ECellLayout layout = ECellLayout::RowMajor);
+    /* The valid states of the environment are live, numbered in the environment's layout order. */
+    FRoomCellIndex(const NavigationEnvironment& environment);
+    /* One flag per cell, row-major. */
+    FRoomCellIndex(int numX, int numY, const TArray<bool>& liveCells, ECellLayout layout = ECellLayout::RowMajor);
+
+    /* One entry per cell, row-major: the cell's ordinal if it is live, INDEX_NONE if it isn't. Blocks store their index like this. */
+    void GetLiveOrdinals(int32* outLiveOrdinals) const;
+    /* Rebuilds the index from GetLiveOrdinals output, in whichever layout it was numbered in. Returns false, leaving the index empty, 
+       if it isn't valid. */
+    bool SetLiveOrdinals(int numX, int numY, const int32* liveOrdinals);
+
+    int NumX() const { return SizeX; }
+    int NumY() const { return SizeY; }
+    ECellLayout GetLayout() const { return Layout; }
+    /* The live cells, plus one for the dead cells if there are any. */
+    int GetNumOrdinals() const { return Cells.Num(); }
+    int GetOrdinal(FIntPoint position) const { return Ordinals[position.X * SizeY + position.Y]; }
+    int GetOrdinal(int cell) const { return Ordinals[cell]; }
+    /* The cell an ordinal stands for, or INDEX_NONE for the dead cells' ordinal. */
+    int GetCell(int ordinal) const { return Cells[ordinal]; }
+    bool IsLive(FIntPoint position) const { return GetCell(GetOrdinal(position)) != INDEX_NONE; }
+    const int32* GetOrdinals() const { return Ordinals.GetData(); }
+
+    bool operator==(const FRoomCellIndex& other) const { return SizeX == other.SizeX && SizeY == other.SizeY && Ordinals == other.Ordinals && Cells == other.Cells; }
+    bool operator!=(const FRoomCellIndex& other) const { return !(*this == other); }
 
-    void IncrementExplorations() { ++NumExplorations; }
-    float GetExploreProbability() const { return FMath::Clamp(1.0f - (NumExplorations / GridTrainingConstants::ExploreCount), 0.0f, 1.0f); }
 private:
-    TArray<float> ActionQValues{ 0.0f, 0.0f, 0.0f, 0.0f };
-    TArray<float> ActionRewards{ GridTrainingConstants::MovementCost, GridTrainingConstants::MovementCost,
-                                 GridTrainingConstants::MovementCost, GridTrainingConstants::MovementCost };
+    /* Numbers the live cells in layout order and gives the rest the last ordinal. */
+    void Build(int numX, int numY, const TArray<bool>& liveCells, ECellLayout layout);
+
+    int SizeX = 0;
+    int SizeY = 0;
+    ECellLayout Layout = ECellLayout::RowMajor;
+    TArray<int32> Ordinals;
+    TArray<int32> Cells;
+};
 
-    TArray<RewardTracker> ActionRewardTrackers{RewardTracker(), RewardTracker(), RewardTracker(), RewardTracker()};
-    float NumExplorations = (float)NUM_TRAINING_SIMULATIONS;
+struct FRoomSymmetry;
+struct FMappedPolicyLibraryFile;
+
+/* ActionQValuesAndRewards for each position in a room for each target position in the room.
+   Everything lives in one cache-line-aligned block. It starts with the cell ordinals, followed by the qvalue plane, indexed 
+   [goal][cell][action], where goals and cells are both FRoomCellIndex ordinals. So the plane only grows with the square of the 
+   room's open cells, and a block describes itself when it is saved or mapped. 
+   Rewards aren't stored: they're QValuesRewardsSet::GetImplicitReward, apart from a few sparse overrides. What enemies learn at 
+   runtime goes in the room's RealtimeLearningOverlay instead. */
+class RoomTargetsQValuesRewardsSets
+{
+public:
+    RoomTargetsQValuesRewardsSets() {}
+    /* Sets with an entry for every cell. */
+    RoomTargetsQValuesRewardsSets(int numX, int numY);
+    RoomTargetsQValuesRewardsSets(const FRoomCellIndex& cellIndex);
+    /* Copies of a block saved from other sets. Check it with GetBlockSize first. */
+    RoomTargetsQValuesRewardsSets(int numX, int numY, const uint8* block);
+    /* Sets that view a block in a mapped policy library instead of owning one. They must never be written to; copies are writable. */
+    RoomTargetsQValuesRewardsSets(int numX, int numY, const uint8* mappedBlock, const TSharedPtr<FMappedPolicyLibraryFile, ESPMode::ThreadSafe>& mappedFile);
+    RoomTargetsQValuesRewardsSets(const RoomTargetsQValuesRewardsSets& other);
+    RoomTargetsQValuesRewardsSets(RoomTargetsQValuesRewardsSets&& other);
+    RoomTargetsQValuesRewardsSets& operator=(const RoomTargetsQValuesRewardsSets& other);
+    RoomTargetsQValuesRewardsSets& operator=(RoomTargetsQValuesRewardsSets&& other);
+    ~RoomTargetsQValuesRewardsSets();
+
+    bool IsAllocated() const { return Block != nullptr; }
+    bool IsReadOnly() const { return MappedFile.IsValid(); }
+    int NumX() const { return SizeX; }
+    int NumY() const { return SizeY; }
+    int GetNumStates() const { return CellIndex.GetNumOrdinals(); }
+    const FRoomCellIndex& GetCellIndex() const { return CellIndex; }
+    SIZE_T GetAllocatedSize() const { return BlockSize; }
+    /* The whole block, for saving and loading trained sets. Its layout depends on the room size, its open cells and the platform cache line size. */
+    const uint8* GetBlockData() const { return Block; }
+    uint8* GetBlockData() { return Block; }
+    /* The size of the block that starts with these bytes, going by its cell ordinals. 0 if they aren't valid, or the block would be bigger than maxSize. */
+    static SIZE_T GetBlockSize(int numX, int numY, const uint8* block, SIZE_T maxSize);
+
+    QValuesRewardsSet GetQValuesRewardsSet(FIntPoint goalPosition);
+    const QValuesRewardsSet GetQValuesRewardsSet(FIntPoint goalPosition) const;
+    ActionQValuesAndRewards GetActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position);
+    const ActionQValuesAndRewards GetActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position) const;
+
+    /* Fills these sets with the source sets as seen through the symmetry: the entry for (goal, cell, action) here is the source entry 
+       for the transformed goal, cell and action. The source room has to be square. */
+    void CopyTransformedFrom(const RoomTargetsQValuesRewardsSets& source, const FRoomSymmetry& symmetry);
+    /* Fills these sets with the source sets re-laid out for another cell index of the same size. Entries for goals and cells that 
+       are live in both keep their values; the rest start out as in fresh sets. */
+    void CopyReindexedFrom(const RoomTargetsQValuesRewardsSets& source, const FRoomCellIndex& cellIndex);
+
+    /* Custom rewards for single moves, in place of the implicit ones. Keep them to a handful: every reward lookup checks the map 
+       once there are any. They aren't part of the block, so saved and mapped sets don't carry them. Both cells have to be live. */
+    void SetRewardOverride(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType, float reward);
+    void ClearRewardOverrides() { RewardOverrides.Empty(); }
+    int GetNumRewardOverrides() const { return RewardOverrides.Num(); }
+
+private:
+    int GetCellOrdinal(FIntPoint position) const { return CellIndex.GetOrdinal(position); }
+    /* Copies the source entry for (sourceOrdinals[goal], sourceOrdinals[cell], sourceActions[action]) into each (goal, cell, action).
+       Goals and cells that map to INDEX_NONE are left alone. Reward overrides are carried over the same way. */
+    void CopyMappedFrom(const RoomTargetsQValuesRewardsSets& source, const TArray<int32>& sourceOrdinals, const int* sourceActions);
+    void Allocate(const FRoomCellIndex& cellIndex);
+    /* Works out the stride and block size for the cell index, without allocating. */
+    void SetLayout(const FRoomCellIndex& cellIndex);
+    void SetPlanes(uint8* block);
+    SIZE_T GetCellOrdinalsPlaneSize() const { return Align(sizeof(int32) * SizeX * SizeY, (SIZE_T)PLATFORM_CACHE_LINE_SIZE); }
+    SIZE_T GetQValuesPlaneSize() const { return Align(sizeof(float) * GoalStride * GetNumStates(), (SIZE_T)PLATFORM_CACHE_LINE_SIZE); }
+    void Release();
+    /* Zero qvalues. */
+    void InitialiseValues();
+
+    int SizeX = 0;
+    int SizeY = 0;
+    FRoomCellIndex CellIndex;
+    /* Number of floats per goal in the qvalue plane. Padded so each goal slice starts on a cache line. */
+    int GoalStride = 0;
+    SIZE_T BlockSize = 0;
+    uint8* Block = nullptr;
+    float* QValues = nullptr;
+    /* Keyed by the Q value entry, (goal * GetNumStates() + cell) * NumDirectionTypes + action. */
+    TMap<int32, float> RewardOverrides;
+    /* Keeps the library mapped while these sets view it. Null for sets that own their block. */
+    TSharedPtr<FMappedPolicyLibraryFile, ESPMode::ThreadSafe> MappedFile;
 };
 
 namespace
 {
-    /* Action targets for each position in a room. */
-    typedef TArray<TArray<ActionTargets>> NavigationEnvironment;
-    /* ActionQValuesAndRewards for each position in a room (for a fixed target position). */
-    typedef TArray<TArray<ActionQValuesAndRewards>> QValuesRewardsSet;
-    /* ActionQValuesAndRewards for each position in a room for each target position in the room. */
-    typedef TArray<TArray<QValuesRewardsSet>> RoomTargetsQValuesRewardsSets;
-
-    const ActionTargets& Get_ActionTargets(const NavigationEnvironment& navEnvironment, FIntPoint position) { return navEnvironment[position.X][position.Y]; }
-    const ActionQValuesAndRewards& Get_ActionQValuesAndRewards(const QValuesRewardsSet& qValuesRewards , FIntPoint position) { return qValuesRewards[position.X][position.Y]; }
-    const QValuesRewardsSet& Get_QValuesRewardsSet_For_GoalPosition(const RoomTargetsQValuesRewardsSets& roomQValuesRewards, FIntPoint goalPosition) { return roomQValuesRewards[goalPosition.X][goalPosition.Y]; }
-    const ActionQValuesAndRewards& Get_ActionQValuesAndRewards_FromRoom(const RoomTargetsQValuesRewardsSets& roomQValuesRewards, FIntPoint goalPosition, FIntPoint currentPosition)
-    {
-        return Get_ActionQValuesAndRewards(Get_QValuesRewardsSet_For_GoalPosition(roomQValuesRewards, goalPosition), currentPosition);
-    }
+    const ActionTargets& Get_ActionTargets(const NavigationEnvironment& navEnvironment, FIntPoint position) { return navEnvironment.GetActionTargets(position); }
 
-    ActionTargets& Get_mActionTargets(NavigationEnvironment& navEnvironment, FIntPoint position) { return navEnvironment[position.X][position.Y]; }
-    ActionQValuesAndRewards& Get_mActionQValuesAndRewards(QValuesRewardsSet& navSet, FIntPoint position) { return navSet[position.X][position.Y]; }
-    QValuesRewardsSet& Get_mQValuesRewardsSet_For_GoalPosition(RoomTargetsQValuesRewardsSets& roomNavSets, FIntPoint goalPosition) { return roomNavSets[goalPosition.X][goalPosition.Y]; }
-    ActionQValuesAndRewards& Get_mActionQValuesAndRewards_FromRoom(RoomTargetsQValuesRewardsSets& roomNavSets, FIntPoint goalPosition, FIntPoint position)
-    {
-        return Get_mActionQValuesAndRewards(Get_mQValuesRewardsSet_For_GoalPosition(roomNavSets, goalPosition), position);
-    }
+    ActionTargets& Get_mActionTargets(NavigationEnvironment& navEnvironment, FIntPoint position) { return navEnvironment.GetActionTargets(position); }
 
-    void InitialiseNavEnvironment(NavigationEnvironment& navSet, int numX, int numY)
-    {
-        for (int x = 0; x < numX; ++x)
-        {
-            navSet.Add(TArray<ActionTargets>());
-            navSet[x].AddDefaulted(numY);
-        }
-    }
-    void InitialiseQValuesRewardsSet(QValuesRewardsSet& navSet, int numX, int numY)
-    {
-        for (int x = 0; x < numX; ++x)
-        {
-            navSet.Add(TArray<ActionQValuesAndRewards>());
-            navSet[x].AddDefaulted(numY);
-        }
-    }
-    void InitialiseRoomTargetsQValuesRewardsSets(RoomTargetsQValuesRewardsSets& targetsSets, int numX, int numY)
+    FIntPoint Get_InRoomActionTarget(const NavigationEnvironment& navEnvironment, FIntPoint position, EDirectionType actionType)
     {
-        for (int x = 0; x < numX; ++x)
-        {
-            targetsSets.Add(TArray<QValuesRewardsSet>());
-            for (int y = 0; y < numY; ++y)
-            {
-                targetsSets[x].Add(QValuesRewardsSet());
-                InitialiseQValuesRewardsSet(targetsSets[x][y], numX, numY);
-                if (x > 0)
-                    targetsSets[x][y][x - 1][y].SetActionReward(EDirectionType::North, GridTrainingConstants::GoalReward);
-                if (y > 0)
-                    targetsSets[x][y][x][y - 1].SetActionReward(EDirectionType::East, GridTrainingConstants::GoalReward);
-                if (x < numX - 1)
-                    targetsSets[x][y][x + 1][y].SetActionReward(EDirectionType::South, GridTrainingConstants::GoalReward);
-                if (y < numY - 1)
-                    targetsSets[x][y][x][y + 1].SetActionReward(EDirectionType::West, GridTrainingConstants::GoalReward);
-                //targetNavSets[x][y][x][y].SetAsGoal();
-            }
-        }
+        return navEnvironment.GetInRoomActionTarget(position, actionType);
     }
 
-    void GetNavigationEnvironmentForRoom(TArray<TArray<int>> roomStructure, FIntPoint roomCoords, NavigationEnvironment& navEnvironment)
+    void GetNavigationEnvironmentForRoom(TArray<TArray<int>> roomStructure, FIntPoint roomCoords, NavigationEnvironment& navEnvironment, 
+                                         ECellLayout layout = ECellLayout::RowMajor)
     {
         const int sizeX = roomStructure.Num();
         const int sizeY = roomStructure[0].Num();
-        navEnvironment.Empty();
+        navEnvironment = NavigationEnvironment(sizeX, sizeY, layout);
         for (int x = 0; x < sizeX; ++x)
         {
-            navEnvironment.Add(TArray<ActionTargets>());
-            TArray<ActionTargets>& row = navEnvironment[x];
             for (int y = 0; y < sizeY; ++y)
             {
-                row.Add(ActionTargets());
-                ActionTargets& state = row[y];
+                ActionTargets& state = navEnvironment.GetActionTargets(FIntPoint(x, y));
                 state.SetValid(roomStructure[x][y] == (int)ECellState::Open || roomStructure[x][y] == (int)ECellState::Door);
                 if (state.IsStateValid())
                 {
@@ -511,15 +847,13 @@ namespace
                         EDirectionType actionType = EDirectionType(a);
                         FIntPoint targetPoint = LevelBuilderHelpers::GetTargetPointForAction(FIntPoint(x, y), actionType);
 
-                        FRoomPositionPair actionTarget = {roomCoords, targetPoint};
-
                         const bool targetValid = LevelBuilderHelpers::GridPositionIsValid(targetPoint, sizeX, sizeY) &&
                             (roomStructure[targetPoint.X][targetPoint.Y] == (int)ECellState::Open || roomStructure[targetPoint.X][targetPoint.Y] == (int)ECellState::Door);
 
                         if (!targetValid)
-                            actionTarget = {roomCoords, FIntPoint(x, y) };
+                            targetPoint = FIntPoint(x, y);
                         
-                        state.SetActionTarget(actionType, actionTarget);
+                        navEnvironment.SetActionTarget(FIntPoint(x, y), actionType, targetPoint);
                     }
                 }
             }
@@ -527,22 +861,232 @@ namespace
     }
 };
 
-struct RoomState
+//====================================================================================================
+// BellmanSweepKernel
+//====================================================================================================
+
+/* Synchronous Bellman backup of every cell and action in a room, for one goal at a time. Successor cells are looked up once from the
+   navigation environment, so a sweep is one aligned load, a 4-wide gather and two multiply-adds per cell. Cells are swept, and their 
+   values gathered, in the environment's cell layout order. */
+class BellmanSweepKernel
 {
-    enum Status : uint8
+public:
+    BellmanSweepKernel(const NavigationEnvironment& environment);
+
+    /* The same update as ActionQValuesAndRewards::UpdateQValue: Q = (1 - learningRate) * Q + learningRate * (reward + discountFactor * max Q' - Q). 
+       Returns the largest change to any Q value. */
+    float Sweep(QValuesRewardsSet& qValuesRewardsSet, FIntPoint goalPosition, float learningRate, float discountFactor);
+
+private:
+    int SizeX = 0;
+    int SizeY = 0;
+    /* Row-major, in layout order. */
+    TArray<int32> ValidCells;
+    /* The environment's layout offset for each row-major cell. */
+    TArray<int32> CellOffsets;
+    /* The layout offsets of the four successor cells (one per action) for each valid cell, in ValidCells order. */
+    TArray<int32> Successors;
+    /* Max Q value of each cell at the start of the current sweep, indexed by layout offset. */
+    TArray<float> CellValues;
+};
+
+//====================================================================================================
+// LockstepEpisodeKernel
+//====================================================================================================
+
+/* Steps a batch of simulated Q-learning episodes in lockstep, one lane per episode. Each step transposes 4 lanes' Q values at a time, 
+   so the greedy argmax, the max next Q value and the deltaQs are all worked out 4 lanes wide. Updates use the same rule as 
+   ULevelTrainerComponent::SimulateRun. */
+class LockstepEpisodeKernel
+{
+public:
+    static constexpr int NumLanes = 8;
+
+    LockstepEpisodeKernel(const NavigationEnvironment& environment);
+
+    /* Runs up to NumLanes episodes from startPosition. Lanes read the Q values from the start of each step. Lanes that take the same action 
+       from the same cell in a step make one update between them, so averageDeltaQ is per update applied, which can be fewer than the actions 
+       taken. numActionsTaken is the mean number of actions per episode. */
+    void SimulateRuns(QValuesRewardsSet& qValuesRewardsSet, FIntPoint goalPosition, FIntPoint startPosition, int numEpisodes, int maxNumActions, 
+                      float learningRate, float discountFactor, float& averageDeltaQ, int& numActionsTaken);
+
+private:
+    int SizeX = 0;
+    int SizeY = 0;
+    /* Four successor cells (one per action) for every cell. */
+    TArray<int32> Successors;
+};
+
+//====================================================================================================
+// PrioritizedSweepRetrainer
+//====================================================================================================
+
+/* Repairs a room's trained Q tables after its navigation environment changes, instead of retraining every goal from scratch. 
+   Cells whose validity or successors changed are backed up first. Value changes are then pushed back to predecessor cells through 
+   a priority queue (biggest change first), so only the affected states get touched. Uses the same backup as the exact solver. */
+class PrioritizedSweepRetrainer
+{
+public:
+    PrioritizedSweepRetrainer(const NavigationEnvironment& previousEnvironment, const NavigationEnvironment& environment);
+
+    bool HasChanges() const { return NumChangedCells > 0; }
+    /* Returns the number of cell backups it took. */
+    int RetrainGoal(QValuesRewardsSet& qValuesRewardsSet, FIntPoint goalPosition, float discountFactor);
+
+private:
+    int SizeX = 0;
+    int SizeY = 0;
+    int NumChangedCells = 0;
+    TArray<bool> ChangedCells;
+    TArray<bool> ValidCells;
+    /* Four in-room successor cells (one per action) for every cell. */
+    TArray<int32> Successors;
+    /* The cells that can move into each cell, back to back. PredecessorsStart has one extra entry at the end. */
+    TArray<int32> Predecessors;
+    TArray<int32> PredecessorsStart;
+};
+
+#if !UE_BUILD_SHIPPING
+//====================================================================================================
+// CellLayoutBenchmark
+//====================================================================================================
+
+struct FCellLayoutBenchmarkResult
+{
+    ECellLayout Layout = ECellLayout::RowMajor;
+    double SweepSeconds = 0.0;
+    double WalkSeconds = 0.0;
+    /* Misses in the simulated cache, per cell swept and per step walked. */
+    float SweepMissesPerCell = 0.0f;
+    float WalkMissesPerStep = 0.0f;
+};
+
+/* Compares the cell layouts on the two ways the Q tables get read: BellmanSweepKernel sweeps, and enemy-like random walks that read the 
+   cell they're in and the one they move to. Both run over one goal's Q values for an open sideLength x sideLength room, with the same 
+   walk for every layout. Hardware counters aren't available in game, so besides timing them it counts misses in a simulated 
+   set-associative cache of numCacheLines 64 byte lines. */
+namespace CellLayoutBenchmark
+{
+    void Run(int sideLength, int numSweeps, int numWalkSteps, int numCacheLines, TArray<FCellLayoutBenchmarkResult>& outResults);
+};
+#endif // !UE_BUILD_SHIPPING
+
+//====================================================================================================
+// FrozenPolicyTable
+//====================================================================================================
+
+/* The optimal actions of a trained room, compiled down to one 4-bit FDirectionSet mask per (goal, cell), two to a byte, indexed
+   [goal][cell] like the Q tables. It's all an enemy needs to navigate a room it no longer learns in: 5 KB at most for a 10x10 room. */
+class FrozenPolicyTable
+{
+public:
+    /* validActionMasks holds the valid actions of every cell (as FDirectionSet masks), indexed X * NumY + Y. */
+    FrozenPolicyTable(const RoomTargetsQValuesRewardsSets& qValuesRewardsSets, const TArray<uint8>& validActionMasks);
+    /* Bakes the shortest-path policies of an untrained room, for the cells of cellIndex (which must be the room's size). */
+    FrozenPolicyTable(const RoomDistanceField& distanceField, const FRoomCellIndex& cellIndex);
+
+    FDirectionSet GetOptimalActions(FIntPoint goalPosition, FIntPoint position) const;
+    SIZE_T GetAllocatedSize() const { return PackedMasks.GetAllocatedSize(); }
+
+private:
+    /* The same cell ordinals as the tables it was compiled from. Dead cells have no valid actions. */
+    FRoomCellIndex CellIndex;
+    TArray<uint8> PackedMasks;
+};
+
+//====================================================================================================
+// QuantizedQValuesTable
+//====================================================================================================
+
+/* A trained room's Q values in Half or Int8 storage, indexed [goal][cell][action] like the float tables, so the room can drop its 
+   float tables. Realtime updates are applied to the dequantized value and requantized (clamped to the goal's range in Int8), 
+   rather than kept as deltas in the room's RealtimeLearningOverlay. Observed rewards still go in the overlay. */
+class QuantizedQValuesTable
+{
+public:
+    QuantizedQValuesTable(const RoomTargetsQValuesRewardsSets& qValuesRewardsSets, EQValueStorageMode storageMode);
+
+    EQValueStorageMode GetStorageMode() const { return StorageMode; }
+    float GetQValue(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType) const;
+    /* Same as ActionQValuesAndRewards::GetOptimalQValueAndActions_Valid: actions are ranked by their Q value plus the average reward 
+       observed in learningState, which can be null. The cell's values are dequantized once, up front. */
+    float GetOptimalQValueAndActions_Valid(FIntPoint goalPosition, FIntPoint position, FDirectionSet& ValidActions, const FRealtimeLearningState* learningState = nullptr) const;
+    /* Same as ActionQValuesAndRewards::UpdateQValue. Int8 values round up or down at random in proportion to the remainder, so updates
+       smaller than a quantization step still move the value on average. */
+    void UpdateQValue(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType, float learningRate, float deltaQ);
+    /* The rewards aren't stored. They're the implicit ones (QValuesRewardsSet::GetImplicitReward); reward overrides are dropped. */
+    float GetActionReward(FIntPoint goalPosition, FIntPoint position, EDirectionType actionType) const;
+    /* Writes the values into fresh float tables with the same cell index. */
+    void DequantizeTo(RoomTargetsQValuesRewardsSets& qValuesRewardsSets) const;
+    const FRoomCellIndex& GetCellIndex() const { return CellIndex; }
+    SIZE_T GetAllocatedSize() const { return HalfValues.GetAllocatedSize() + ByteValues.GetAllocatedSize() + GoalRanges.GetAllocatedSize(); }
+
+private:
+    /* goal and cell are cell ordinals. */
+    int GetEntryIndex(int goal, int cell, EDirectionType actionType) const { return (goal * CellIndex.GetNumOrdinals() + cell) * (int)EDirectionType::NumDirectionTypes + (int)actionType; }
+    float Dequantize(int goal, int entry) const;
+    void Requantize(int goal, int entry, float value, bool roundStochastically);
+    FIntPoint GetPosition(int ordinal) const;
+
+    /* Int8 values map bytes 0-255 linearly onto the smallest and largest value trained for the goal. */
+    struct FGoalRange
     {
-        Dead,
-        Training,
-        Trained,
-        Connected
+        float Min = 0.0f;
+        float Step = 0.0f;
     };
 
-    RoomState() 
-    {}
+    EQValueStorageMode StorageMode = EQValueStorageMode::Half;
+    /* The same cell ordinals as the tables it was quantized from. */
+    FRoomCellIndex CellIndex;
+    TArray<FFloat16> HalfValues;
+    TArray<uint8> ByteValues;
+    TArray<FGoalRange> GoalRanges;
+};
+
+/* The heavy per-room data (Q tables, navigation environment, tile counters). It only exists while the room is alive: it is created when
+   the room is enabled and released when the room is disabled. The trainer thread holds its own reference while training, so a room 
+   can be disabled mid-training without pulling the tables out from under it. */
+typedef TSharedPtr<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe> RoomTargetsQValuesRewardsSetsPtr;
+
+/* A room's realtime learning, kept apart from its trained tables: only the (goal, cell) states enemies actually visit get an 
+   FRealtimeLearningState. The trained tables stay as they were trained, so they can go on being shared while enemies learn. */
+class RealtimeLearningOverlay
+{
+public:
+    RealtimeLearningOverlay(FIntPoint roomDimensions) : RoomDimensions(roomDimensions) {}
+
+    /* Null if nothing has been learned for the state. */
+    const FRealtimeLearningState* Find(FIntPoint goalPosition, FIntPoint position) const { return States.Find(GetKey(goalPosition, position)); }
+    FRealtimeLearningState& FindOrAdd(FIntPoint goalPosition, FIntPoint position) { return States.FindOrAdd(GetKey(goalPosition, position)); }
+    /* The Q value deltas only make sense on top of the tables they were learned on, so they go when the tables are retrained. 
+       Observed rewards and explore counts are kept. */
+    void ResetQValueDeltas();
+    bool HasQValueDeltas() const;
+    /* Adds the Q value deltas into the tables they were learned on, then clears them. Deltas learned in cells that have since 
+       closed are dropped. */
+    void FoldQValueDeltasInto(RoomTargetsQValuesRewardsSets& qValuesRewardsSets);
+    int Num() const { return States.Num(); }
+    SIZE_T GetAllocatedSize() const { return States.GetAllocatedSize(); }
+
+private:
+    int32 GetKey(FIntPoint goalPosition, FIntPoint position) const
+    {
+        const int numCells = RoomDimensions.X * RoomDimensions.Y;
+        return (goalPosition.X * RoomDimensions.Y + goalPosition.Y) * numCells + position.X * RoomDimensions.Y + position.Y;
+    }
+
+    FIntPoint RoomDimensions;
+    TMap<int32, FRealtimeLearningState> States;
+};
 
-    RoomState(FIntPoint roomDimensions)
+struct RoomPayload
+{
+    RoomPayload(FIntPoint roomDimensions, ECellLayout cellLayout = ECellLayout::RowMajor)
+        : RealtimeLearning(roomDimensions)
+        , RoomDimensions(roomDimensions)
+        , CellLayout(cellLayout)
+        , QValuesRewardsSets(MakeShared<RoomTargetsQValuesRewardsSets, ESPMode::ThreadSafe>(FRoomCellIndex(roomDimensions.X, roomDimensions.Y, cellLayout)))
     {
-        InitialiseRoomTargetsQValuesRewardsSets(QValuesRewardsSets, roomDimensions.X, roomDimensions.Y);
         for (int x = 0; x < roomDimensions.X; ++x)
         {
             TArray<FThreadSafeCounter> states;
@@ -551,16 +1095,300 @@ struct RoomState
         }
     }
 
+    const RoomTargetsQValuesRewardsSets& GetQValuesRewardsSets() const { return *QValuesRewardsSets; }
+    /* The Q tables may be shared with other rooms that have the same layout, or mapped read-only from the policy library, 
+       so they get copied the first time this room writes to them. Quantized Q values are dequantized back into float tables; 
+       a frozen room gets fresh tables, and has to be retrained. */
+    RoomTargetsQValuesRewardsSets& GetMutableQValuesRewardsSets();
+    /* Replaces this room's Q tables with tables trained for the same layout. They are only copied if this room writes to them. */
+    void ShareQValuesRewardsSets(const RoomTargetsQValuesRewardsSetsPtr& sharedSets);
+    RoomTargetsQValuesRewardsSetsPtr GetSharedQValuesRewardsSets() const { return QValuesRewardsSets; }
+    /* The trained values for a move with the realtime learning merged in. Learning through the non-const view adds the state to 
+       RealtimeLearning if it isn't there yet, and never writes to the Q tables, so they don't need copying. */
+    ActionQValuesAndRewards GetLearningActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position);
+    const ActionQValuesAndRewards GetLearningActionQValuesAndRewards(FIntPoint goalPosition, FIntPoint position) const;
+    /* Lays the Q tables out for the valid states of NavEnvironment, if they aren't already, keeping the values of cells that were 
+       open before. Frozen and quantized rooms are thawed first. Call it on the game thread whenever the environment might have 
+       changed, before training. */
+    void ReindexQValuesRewardsSets();
+    /* Folds the realtime Q value deltas into the room's own copy of its Q tables. Quantizing or freezing the tables would otherwise 
+       lose them. */
+    void FoldRealtimeQValueDeltas();
+
+    /* Swaps the Q tables for a quantized copy of them, which enemies can keep learning in. Dropped tables are freed as in Freeze. */
+    void Quantize(TUniquePtr<QuantizedQValuesTable>&& quantizedQValues);
+    /* Null unless the room's Q values are quantized. */
+    QuantizedQValuesTable* GetQuantizedQValues() { return QuantizedQValues.Get(); }
+    const QuantizedQValuesTable* GetQuantizedQValues() const { return QuantizedQValues.Get(); }
+
+    /* Swaps the Q tables for the frozen policy compiled from them. The room drops its reference to the tables, so they're freed 
+       unless the trained room cache (or another room) still holds them. */
+    void Freeze(TUniquePtr<FrozenPolicyTable>&& frozenPolicy);
+    bool IsFrozen() const { return FrozenPolicy.IsValid(); }
+    /* Null unless the room is frozen. */
+    const FrozenPolicyTable* GetFrozenPolicy() const { return FrozenPolicy.Get(); }
+    /* False if the room only has a frozen policy or quantized Q values. */
+    bool HasFloatQValues() const { return !FrozenPolicy.IsValid() && !QuantizedQValues.IsValid(); }
+
+    /* Makes the Q tables this room's own and hands them to a trainer thread, on the game thread before it starts. Pinned tables 
+       stay put until UnpinFromTraining: they can't be shared, reindexed, quantized or frozen, and they aren't copied on write. */
+    RoomTargetsQValuesRewardsSetsPtr PinForTraining();
+    void UnpinFromTraining();
+    bool IsBeingTrained() const { return NumTrainingPins > 0; }
+
+    /* The layout NavEnvironment should be built in, which its Q tables then follow. */
+    ECellLayout GetCellLayout() const { return CellLayout; }
+    /* The cell index of NavEnvironment, or one with every cell live if it hasn't been set yet. */
+    FRoomCellIndex GetNavCellIndex() const;
+
+    /** Count of the number of actors occupying each grid position in the room. */
+    TArray<TArray<FThreadSafeCounter>> TileActorCounters;
+    /** Action rewards and targets for each of the positions in the room. */
+    NavigationEnvironment NavEnvironment;
+    /** What enemies have learned about the room while the game runs. */
+    RealtimeLearningOverlay RealtimeLearning;
+
+private:
+    FIntPoint RoomDimensions;
+    ECellLayout CellLayout;
+    /** QValues and rewards for each target position in room */
+    RoomTargetsQValuesRewardsSetsPtr QValuesRewardsSets;
+    TUniquePtr<FrozenPolicyTable> FrozenPolicy;
+    TUniquePtr<QuantizedQValuesTable> QuantizedQValues;
+    int32 NumTrainingPins = 0;
+};
+
+typedef TSharedPtr<RoomPayload, ESPMode::ThreadSafe> RoomPayloadPtr;
+
+/* Everything that decides what a room trains to: its inner walls, its door positions and its size. */
+struct FRoomLayoutKey
+{
+    InnerRoomBitmask InnerStructure = 0;
+    /* Indexed by EDirectionType. */
+    int32 DoorPositions[(int)EDirectionType::NumDirectionTypes] = { 0, 0, 0, 0 };
+    FIntPoint RoomDimensions = FIntPoint(0, 0);
+
+    bool operator==(const FRoomLayoutKey& other) const
+    {
+        return InnerStructure == other.InnerStructure && RoomDimensions == other.RoomDimensions
+            && FMemory::Memcmp(DoorPositions, other.DoorPositions, sizeof(DoorPositions)) == 0;
+    }
+
+    friend uint32 GetTypeHash(const FRoomLayoutKey& key)
+    {
+        uint32 hash = HashCombine(GetTypeHash(key.InnerStructure), GetTypeHash(key.RoomDimensions));
+        for (int d = 0; d < (int)EDirectionType::NumDirectionTypes; ++d)
+            hash = HashCombine(hash, GetTypeHash(key.DoorPositions[d]));
+        return hash;
+    }
+};
+
+/* One of the 8 rotations and reflections of a square room. It acts on cells (around the room centre) and on directions, so a room 
+   and its rotated or mirrored copy are the same navigation problem with the cells, goals and actions relabelled. */
+struct FRoomSymmetry
+{
+    static constexpr int NumSymmetries = 8;
+
+    FRoomSymmetry() {}
+    /* 0 is the identity, 1-3 are quarter turns (each one takes North to East), 4-7 are the same turns after mirroring East and West. */
+    static FRoomSymmetry FromIndex(int index);
+    /* Writes the canonical form of the layout (the smallest of its transformed layouts) and returns the index of the symmetry that 
+       takes the layout to it. Rooms that aren't square are their own canonical form. */
+    static int Canonicalize(const FRoomLayoutKey& layout, FRoomLayoutKey& outCanonical);
+
+    bool IsIdentity() const { return XX == 1 && XY == 0 && YX == 0 && YY == 1; }
+    FRoomSymmetry Inverse() const { return FRoomSymmetry(XX, YX, XY, YY); }
+    /* The symmetry that applies other first, then this one. */
+    FRoomSymmetry Compose(const FRoomSymmetry& other) const;
+
+    FIntPoint TransformCell(FIntPoint cell, int sideLength) const;
+    EDirectionType TransformDirection(EDirectionType direction) const;
+    InnerRoomBitmask TransformInnerStructure(InnerRoomBitmask innerStructure, int innerSideLength) const;
+    FRoomLayoutKey TransformLayout(const FRoomLayoutKey& layout) const;
+
+private:
+    FRoomSymmetry(int8 xx, int8 xy, int8 yx, int8 yy) : XX(xx), XY(xy), YX(yx), YY(yy) {}
+
+    /* x' = XX * x + XY * y and y' = YX * x + YY * y, with cells measured from the room centre. */
+    int8 XX = 1;
+    int8 XY = 0;
+    int8 YX = 0;
+    int8 YY = 1;
+};
+
+/* Trained Q tables for each room layout seen so far, so that rooms with the same layout only train once. Rotated and mirrored 
+   layouts count as the same layout: their tables are remapped from the trained ones the first time a room needs them.
+   The tables are shared with the rooms using them and never written in place. Game thread only. */
+class TrainedRoomCache
+{
+public:
+    /* Null if no room with this layout (or a rotation or reflection of it) has finished training. */
+    RoomTargetsQValuesRewardsSetsPtr Find(const FRoomLayoutKey& layout);
+    void Add(const FRoomLayoutKey& layout, const RoomTargetsQValuesRewardsSetsPtr& trainedSets);
+    void Remove(const FRoomLayoutKey& layout);
+    /* The number of distinct layouts, counting rotations and reflections as one. */
+    int Num() const { return Entries.Num(); }
+    /* The sets for every layout, in the canonical orientation. */
+    void GetCanonicalTrainedLayouts(TArray<TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>>& outTrainedLayouts);
+
+private:
+    /* Indexed by the symmetry that takes each orientation to the canonical layout. */
+    struct FTrainedLayout
+    {
+        RoomTargetsQValuesRewardsSetsPtr Orientations[FRoomSymmetry::NumSymmetries];
+    };
+
+    /* Keyed by canonical layout. */
+    TMap<FRoomLayoutKey, FTrainedLayout> Entries;
+};
+
+/* Trained room tables kept on disk between sessions, one file per canonical layout. Each file carries a format version, the layout it 
+   was trained for and a checksum; files that don't check out are deleted rather than loaded. The least recently used files are evicted 
+   once the directory grows past its size limit. Loads run on the game thread, saves run on the thread pool. */
+class TrainedRoomDatabase
+{
+public:
+    TrainedRoomDatabase(const FString& directory, int64 maxSizeBytes);
+    /* Waits for saves that are still in flight. */
+    ~TrainedRoomDatabase();
+
+    /* Null if the layout isn't on disk, or its file fails the integrity checks. */
+    RoomTargetsQValuesRewardsSetsPtr Load(const FRoomLayoutKey& canonicalLayout);
+    /* Saves a room's trained sets in the background, in the canonical orientation. Does nothing if the layout has already been saved. */
+    void SaveAsync(const FRoomLayoutKey& layout, const RoomTargetsQValuesRewardsSetsPtr& trainedSets);
+
+private:
+    static constexpr uint32 FileMagic = 0x52515054; // "TPQR"
+    /* Bump this whenever the block layout, or the scale of the trained values, changes. */
+    static constexpr uint32 FileVersion = 5;
+
+    struct FFileHeader
+    {
+        uint32 Magic;
+        uint32 Version;
+        uint32 CacheLineSize;
+        uint32 Checksum;
+        uint64 BlockSize;
+        FRoomLayoutKey Layout;
+    };
+
+    FString GetFilePath(const FRoomLayoutKey& canonicalLayout) const;
+    void Save(const FRoomLayoutKey& canonicalLayout, int orientation, const RoomTargetsQValuesRewardsSetsPtr& trainedSets);
+    /* Expects DirectorySection to be locked. */
+    void EvictToSizeLimit();
+
+    FString Directory;
+    int64 MaxSizeBytes;
+    /* Layouts loaded or saved this session. Game thread only. */
+    TSet<FRoomLayoutKey> SavedLayouts;
+    TArray<TFuture<void>> PendingSaves;
+    /* Held while files are moved into place, touched or deleted. */
+    FCriticalSection DirectorySection;
+};
+
+/* Keeps a policy library file mapped. Sets that view the library hold a reference to it. */
+struct FMappedPolicyLibraryFile
+{
+    ~FMappedPolicyLibraryFile()
+    {
+        Region.Reset();
+        Handle.Reset();
+    }
+
+    TUniquePtr<IMappedFileHandle> Handle;
+    TUniquePtr<IMappedFileRegion> Region;
+};
+
+/* A read-only file of trained sets for many canonical layouts, that every game instance on a host maps into memory, so the OS page cache 
+   holds a single physical copy of the tables. Offsets in the file are relative to its start and every block is page aligned, so the 
+   sets found in the library view the mapping directly. Each export is a new generation of the library, SharedPolicyLibrary.<n>.qlib, 
+   since a file that is mapped can't be replaced on every platform. Game thread only. */
+class SharedPolicyLibrary
+{
+public:
+    /* Maps the newest generation in the directory. False if there isn't one or its header doesn't check out. */
+    bool Open(const FString& directory);
+    /* Null if the layout isn't in the library, or its block fails its checksum or size checks. */
+    RoomTargetsQValuesRewardsSetsPtr Find(const FRoomLayoutKey& canonicalLayout);
+    /* Writes sets for canonical layouts as the next generation in the directory, which instances opened from then on map. Older 
+       generations are deleted, except those still mapped on platforms that don't allow it; a later export clears those up. */
+    static bool Write(const FString& directory, const TArray<TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>>& trainedLayouts);
+
+private:
+    static constexpr uint32 FileMagic = 0x4C515054; // "TPQL"
+    /* Bump this whenever the block layout, or the scale of the trained values, changes. */
+    static constexpr uint32 FileVersion = 5;
+    static constexpr uint64 BlockAlignment = 4096;
+
+    /* Oldest first. */
+    static void FindGenerations(const FString& directory, TArray<int32>& outGenerations);
+    static FString GetGenerationPath(const FString& directory, int32 generation);
+
+    struct FLibraryHeader
+    {
+        uint32 Magic;
+        uint32 Version;
+        uint32 CacheLineSize;
+        uint32 NumEntries;
+    };
+
+    struct FLibraryEntry
+    {
+        FRoomLayoutKey Layout;
+        uint64 Offset;
+        uint64 BlockSize;
+        uint32 Checksum;
+        uint32 Padding;
+    };
+
+    enum class EEntryState : uint8
+    {
+        Unchecked,
+        Valid,
+        Invalid
+    };
+
+    TSharedPtr<FMappedPolicyLibraryFile, ESPMode::ThreadSafe> MappedFile;
+    /* Points into the mapping. */
+    const FLibraryEntry* Entries = nullptr;
+    /* Blocks are checksummed the first time they are found, so instances only touch the pages of the layouts they use. */
+    TArray<EEntryState> EntryStates;
+    TMap<FRoomLayoutKey, int32> EntryIndices;
+};
+
+struct RoomState
+{
+    enum Status : uint8
+    {
+        Dead,
+        Training,
+        Trained,
+        Connected
+    };
+
+    RoomState() 
+    {}
+
     ~RoomState()
     {}
 
-    void InitializeRoom(float health, float complexity = 0.0f, float density = 0.0f)
+    /* Copies are never needed in passing, so they have to be asked for with CopySharingPayload. */
+    RoomState(RoomState&& other) = default;
+    RoomState& operator=(RoomState&& other) = default;
+    RoomState& operator=(const RoomState& other) = delete;
+
+    /* Copies the room's own fields, but not its payload: the copy points at the same RoomPayload, so its tile counters, navigation 
+       environment, realtime learning and Q tables are the room's, and changes through either show in both. */
+    RoomState CopySharingPayload() const { return RoomState(*this); }
+
+    void InitializeRoom(FIntPoint roomDimensions, float health, float complexity = 0.0f, float density = 0.0f, ECellLayout cellLayout = ECellLayout::RowMajor)
     {
         RoomStatus = Training;
         TrainingProgress = 0.0f;
         RoomHealth = health;
         Complexity = complexity;
         Density = density;
+        Payload = MakeShared<RoomPayload, ESPMode::ThreadSafe>(roomDimensions, cellLayout);
     }
 
     void SetRoomTrained()
@@ -586,35 +1414,33 @@ struct RoomState
         return RoomStatus == Connected;
     }
 
+    bool HasPayload() const
+    {
+        return Payload.IsValid();
+    }
+
+    /* Tiles in rooms that don't exist are always empty. */
     bool TileIsEmpty(FIntPoint TilePosition) const
     {
-        return TileActorCounters[TilePosition.X][TilePosition.Y].GetValue() == 0;
+        return !HasPayload() || Payload->TileActorCounters[TilePosition.X][TilePosition.Y].GetValue() == 0;
     }
 
     void ActorEnteredTilePosition(FIntPoint TilePosition)
     {
-        TileActorCounters[TilePosition.X][TilePosition.Y].Increment();
+        if (HasPayload())
+            Payload->TileActorCounters[TilePosition.X][TilePosition.Y].Increment();
     }
 
     void ActorExitedTilePosition(FIntPoint TilePosition)
     {
-        TileActorCounters[TilePosition.X][TilePosition.Y].Decrement();
+        if (HasPayload())
+            Payload->TileActorCounters[TilePosition.X][TilePosition.Y].Decrement();
     }
 
     void SetNavSetForTarget(FIntPoint targetPosition, const QValuesRewardsSet& navSet)
     {
-        QValuesRewardsSets[targetPosition.X][targetPosition.Y] = navSet;
-    }
-
-    void SetTargetPosition(FIntPoint targetPosition)
-    {
-        if (PrevTargetPos != FIntPoint(-1, -1))
-        {
-
-            NavEnvironment[targetPosition.X][targetPosition.Y].SetIsGoal(false);
-        }
-        NavEnvironment[targetPosition.X][targetPosition.Y].SetIsGoal(true);
-        PrevTargetPos = targetPosition;
+        if (HasPayload() && !Payload->IsBeingTrained())
+            Payload->GetMutableQValuesRewardsSets().GetQValuesRewardsSet(targetPosition).CopyFrom(navSet);
     }
 
     float RoomHealth = 100.0f;
@@ -630,11 +1456,52 @@ struct RoomState
     WallState WestWall;
     /* The point that must be reached in order to unlock/connect the room. */
     FIntPoint SignalPoint = FIntPoint(-1, -1);
-    /** Count of the number of actors occupying each grid position in the room. */
-    TArray<TArray<FThreadSafeCounter>> TileActorCounters;
-    /** Action rewards and targets for each of the positions in the room. */
-    NavigationEnvironment NavEnvironment;
-    /** QValues and rewards for each target position in room */
-    RoomTargetsQValuesRewardsSets QValuesRewardsSets;
-    FIntPoint PrevTargetPos = FIntPoint(-1, -1);
+    /* Q tables, navigation environment and tile counters. Null while the room is dead. */
+    RoomPayloadPtr Payload;
+
+private:
+    RoomState(const RoomState& other) = default;
+};
+
+/* Any RoomState copy other than CopySharingPayload fails to compile. This is a build check, not a per-frame runtime test. */
+static_assert(!std::is_copy_constructible<RoomState>::value && !std::is_copy_assignable<RoomState>::value, "Room states are only copied through CopySharingPayload.");
+
+//====================================================================================================
+// FBuildableRegistry
+//====================================================================================================
+
+/* A buildable item placed in a room, attached to the side of its position that faces Direction. */
+USTRUCT(BlueprintType)
+struct FBuildablePlacement
+{
+    GENERATED_USTRUCT_BODY()
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Buildable Items")
+        FIntPoint PositionInRoom = FIntPoint(0, 0);
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Buildable Items")
+        EDirectionType Direction = EDirectionType::North;
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Buildable Items")
+        EBuildableActorType Type = EBuildableActorType::None;
+};
+
+/* The buildable items placed in the maze. Only rooms with something placed in them have an entry, and only placed items take up 
+   space, so it costs nothing up front however big the maze is. Lookups are two hashes: the room, then the position and direction. */
+class FBuildableRegistry
+{
+public:
+    bool IsPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction) const;
+    /* Replaces whatever was placed there facing that way. */
+    void Place(FRoomPositionPair roomAndPosition, EDirectionType direction, EBuildableActorType type);
+    void Remove(FRoomPositionPair roomAndPosition, EDirectionType direction);
+    /* The items placed in the room. Only the ones of the given type, unless it's None. */
+    void GetPlacementsInRoom(FIntPoint roomCoords, TArray<FBuildablePlacement>& outPlacements, EBuildableActorType type = EBuildableActorType::None) const;
+    int Num() const { return NumPlacements; }
+    void Empty();
+
+private:
+    /* Position in the room and direction, packed into one key. */
+    static int32 GetPlacementKey(FIntPoint positionInRoom, EDirectionType direction);
+    static FBuildablePlacement GetPlacement(int32 placementKey, EBuildableActorType type);
+
+    TMap<FIntPoint, TMap<int32, EBuildableActorType>> Rooms;
+    int NumPlacements = 0;
 };
\ No newline at end of file
@@ -4,6 +4,36 @@
 #include <functional>
 #include "TPGameDemoGameState.h"
 
+namespace
+{
+    FString GetLevelPoliciesDir() { return FPaths::ProjectDir() + "Content/Levels/GeneratedRooms/"; }
+}
+
+#if !UE_BUILD_SHIPPING
+namespace
+{
+    FAutoConsoleCommandWithWorldAndArgs BenchmarkCellLayoutsCommand(
+        TEXT("TPGameDemo.BenchmarkCellLayouts"),
+        TEXT("Logs how the cell layouts compare for sweeps and random walks. Optional argument: the room side length (default 128)."),
+        FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& args, UWorld* world)
+        {
+            ATPGameDemoGameState* gameState = world != nullptr ? Cast<ATPGameDemoGameState>(world->GetGameState()) : nullptr;
+            if (gameState != nullptr)
+                gameState->BenchmarkCellLayouts(args.Num() > 0 ? FCString::Atoi(*args[0]) : 128);
+        }));
+
+    FAutoConsoleCommandWithWorldAndArgs BenchmarkWorldCellQueriesCommand(
+        TEXT("TPGameDemo.BenchmarkWorldCellQueries"),
+        TEXT("Logs how long enemy step queries take through FRoomPositionPairs and FWorldCellIds. Optional argument: the number of queries (default 1000000)."),
+        FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& args, UWorld* world)
+        {
+            ATPGameDemoGameState* gameState = world != nullptr ? Cast<ATPGameDemoGameState>(world->GetGameState()) : nullptr;
+            if (gameState != nullptr)
+                gameState->BenchmarkWorldCellQueries(args.Num() > 0 ? FCString::Atoi(*args[0]) : 1000000);
+        }));
+}
+#endif
+
 //====================================================================================================
 // ATPGameDemoGameState
 //====================================================================================================
@@ -12,9 +42,15 @@ ATPGameDemoGameState::ATPGameDemoGameState(const FObjectInitializer& ObjectIniti
 	PrimaryActorTick.bCanEverTick = true;
     PrimaryActorTick.TickGroup = TG_PostUpdateWork;
 
-    FString LevelPoliciesDir = FPaths::ProjectDir();
-    LevelPoliciesDir += "Content/Levels/GeneratedRooms/";
+    FString LevelPoliciesDir = GetLevelPoliciesDir();
     LevelPoliciesDirFound = FPlatformFileManager::Get().GetPlatformFile().DirectoryExists (*LevelPoliciesDir);
+    if (LevelPoliciesDirFound)
+    {
+        RoomDatabase = MakeUnique<TrainedRoomDatabase>(LevelPoliciesDir, (int64)TRAINED_ROOM_DATABASE_MAX_MB * 1024 * 1024);
+        PolicyLibrary = MakeUnique<SharedPolicyLibrary>();
+        if (!PolicyLibrary->Open(LevelPoliciesDir))
+            PolicyLibrary.Reset();
+    }
 }
 
 ATPGameDemoGameState::~ATPGameDemoGameState()
@@ -44,7 +80,9 @@ void ATPGameDemoGameState::InitialiseArrays()
 {
     ATPGameDemoGameMode* gameMode = (ATPGameDemoGameMode*) GetWorld()->GetAuthGameMode();
 
-    MazePositionBuildableStates.SetNum(NumGridsXY * NumGridsXY * GridUnitLengthXCM * GridUnitLengthYCM);
+    Buildables.Empty();
+    // FWorldCellIds pack room indices and wrapped positions into a byte each.
+    ensure(NumGridsXY + 1 <= 0x100 && NumGridUnitsX - 1 <= 0x100 && NumGridUnitsY - 1 <= 0x100);
     // Add one extra row of room states (where the south wall will be the north wall of the final room, and the west wall will be ignored).
     for (int x = 0; x < NumGridsXY + 1; ++x)
     {
@@ -54,12 +92,14 @@ void ATPGameDemoGameState::InitialiseArrays()
         // Add one extra column of room states (where the west wall will be the east wall of the final room, and the south wall will be ignored).
         for (int y = 0; y < NumGridsXY + 1; ++y)
         {
-            roomsRow.Add(RoomState(FIntPoint(NumGridUnitsX, NumGridUnitsY)));
+            // Room payloads are only allocated once a room is enabled.
+            roomsRow.AddDefaulted();
 
             roomBuilderRow.Add(nullptr);
             wallBuilderRow.Add(nullptr);
         }
-        RoomStates.Add(roomsRow);
+        // Room states can't be copied, only moved.
+        RoomStates.Add(MoveTemp(roomsRow));
         RoomBuilders.Add(roomBuilderRow);
         WallBuilders.Add(wallBuilderRow);
     }
@@ -82,7 +122,6 @@ void ATPGameDemoGameState::Tick( float DeltaTime )
     {
         auto roomCoords = wallPosition.WallCoupleCoords;
         auto wallType = wallPosition.WallType;
-        auto wallState = GetWallState(roomCoords, wallType);
         auto neighbourCoords = GetRoomCoords(GetNeighbouringRoomIndices(roomCoords, wallType));
         bool roomExists = DoesRoomExist(roomCoords);
         bool neighbourExists = DoesRoomExist(neighbourCoords); 
@@ -104,7 +143,9 @@ void ATPGameDemoGameState::Tick( float DeltaTime )
 			// Movement action targets: Update the action targets in the nav position states.
 			FRoomPositionPair doorPos = GetDoorPosition(roomCoords, wallType);
 			FRoomPositionPair targetPos = GetTargetRoomAndPositionForDirectionType(doorPos, wallType);
-			Get_mActionTargets(GetmNavEnvironment(roomCoords), doorPos.PositionInRoom).SetActionTarget(wallType, targetPos);
+			// Room Q tables treat moving through a door like walking into a wall, so opening a door doesn't need any retraining.
+			if (RoomPayload* payload = FindRoomPayload(roomCoords))
+				payload->NavEnvironment.SetCrossRoomActionTarget(doorPos.PositionInRoom, wallType, targetPos.RoomCoords - roomCoords, targetPos.PositionInRoom);
 		}
 		else
 		{
@@ -122,11 +163,198 @@ void ATPGameDemoGameState::Tick( float DeltaTime )
 //============================================================================
 const RoomTargetsQValuesRewardsSets& ATPGameDemoGameState::GetRoomQValuesRewardsSets(FIntPoint roomCoords)
 {
-    FIntPoint roomIndices = GetRoomXYIndicesChecked(roomCoords);
-    return RoomStates[roomIndices.X][roomIndices.Y].QValuesRewardsSets;
+    static const RoomTargetsQValuesRewardsSets EmptyQValuesRewardsSets;
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    return payload != nullptr ? payload->GetQValuesRewardsSets() : EmptyQValuesRewardsSets;
+}
+
+FRoomLayoutKey ATPGameDemoGameState::GetRoomLayoutKey(FIntPoint roomCoords)
+{
+    FRoomLayoutKey layout;
+    layout.InnerStructure = GetRoomInnerStructure(roomCoords);
+    layout.RoomDimensions = FIntPoint(NumGridUnitsX, NumGridUnitsY);
+    TArray<int> neswDoorPositions;
+    GetDoorPositionsNESW(roomCoords, neswDoorPositions);
+    for (int d = 0; d < (int)EDirectionType::NumDirectionTypes; ++d)
+        layout.DoorPositions[d] = neswDoorPositions[d];
+    return layout;
+}
+
+bool ATPGameDemoGameState::ShareTrainedRoomTables(FIntPoint roomCoords)
+{
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    if (payload == nullptr || payload->IsBeingTrained())
+        return false;
+    const FRoomLayoutKey layout = GetRoomLayoutKey(roomCoords);
+    RoomTargetsQValuesRewardsSetsPtr trainedSets = TrainedRooms.Find(layout);
+    if (!trainedSets.IsValid() && (PolicyLibrary.IsValid() || RoomDatabase.IsValid()))
+    {
+        // Not trained this session, but maybe in an earlier one. The library is mapped, so its sets don't cost this instance any memory.
+        FRoomLayoutKey canonicalLayout;
+        FRoomSymmetry::Canonicalize(layout, canonicalLayout);
+        RoomTargetsQValuesRewardsSetsPtr savedSets = PolicyLibrary.IsValid() ? PolicyLibrary->Find(canonicalLayout) : nullptr;
+        if (!savedSets.IsValid() && RoomDatabase.IsValid())
+            savedSets = RoomDatabase->Load(canonicalLayout);
+        if (savedSets.IsValid())
+        {
+            TrainedRooms.Add(canonicalLayout, savedSets);
+            trainedSets = TrainedRooms.Find(layout);
+        }
+    }
+    if (!trainedSets.IsValid())
+        return false;
+    payload->ShareQValuesRewardsSets(trainedSets);
+    return true;
+}
+
+void ATPGameDemoGameState::AddRoomTablesToTrainedCache(FIntPoint roomCoords)
+{
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    if (payload != nullptr && payload->HasFloatQValues())
+        TrainedRooms.Add(GetRoomLayoutKey(roomCoords), payload->GetSharedQValuesRewardsSets());
+}
+
+bool ATPGameDemoGameState::FreezeRoomPolicy(FIntPoint roomCoords)
+{
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    // The trainer thread is still writing the tables.
+    if (payload == nullptr || payload->IsBeingTrained() || !payload->HasFloatQValues() || !payload->GetQValuesRewardsSets().IsAllocated())
+        return false;
+    TArray<uint8> validActionMasks;
+    validActionMasks.Reserve(NumGridUnitsX * NumGridUnitsY);
+    for (int x = 0; x < NumGridUnitsX; ++x)
+        for (int y = 0; y < NumGridUnitsY; ++y)
+            validActionMasks.Add(GetValidActions({ roomCoords, FIntPoint(x, y) }).DirectionsMask);
+    payload->FoldRealtimeQValueDeltas();
+    payload->Freeze(MakeUnique<FrozenPolicyTable>(payload->GetQValuesRewardsSets(), validActionMasks));
+    return true;
+}
+
+bool ATPGameDemoGameState::BakeRoomPolicy(FIntPoint roomCoords)
+{
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    if (payload == nullptr || payload->IsBeingTrained() || !RoomDistanceField::SupportsRoomDimensions(FIntPoint(NumGridUnitsX, NumGridUnitsY)))
+        return false;
+    TArray<int> neswDoorPositions;
+    GetDoorPositionsNESW(roomCoords, neswDoorPositions);
+    const RoomDistanceField distanceField(GetRoomInnerStructure(roomCoords), neswDoorPositions);
+    payload->Freeze(MakeUnique<FrozenPolicyTable>(distanceField, payload->GetNavCellIndex()));
+    return true;
+}
+
+int ATPGameDemoGameState::GetRoomPathLength(FIntPoint roomCoords, FIntPoint goalPosition, FIntPoint position)
+{
+    if (!DoesRoomExist(roomCoords) || !RoomDistanceField::SupportsRoomDimensions(FIntPoint(NumGridUnitsX, NumGridUnitsY)))
+        return -1;
+    TArray<int> neswDoorPositions;
+    GetDoorPositionsNESW(roomCoords, neswDoorPositions);
+    // Only the one goal is solved, rather than the whole room.
+    const uint8 distance = RoomDistanceField(GetRoomInnerStructure(roomCoords), neswDoorPositions, goalPosition).GetDistance(goalPosition, position);
+    return distance != RoomDistanceField::Unreachable ? distance : -1;
+}
+
+bool ATPGameDemoGameState::SetRoomQValueStorageMode(FIntPoint roomCoords, EQValueStorageMode storageMode)
+{
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    if (payload == nullptr || payload->IsFrozen() || payload->IsBeingTrained())
+        return false;
+    const QuantizedQValuesTable* quantizedQValues = payload->GetQuantizedQValues();
+    if (storageMode == (quantizedQValues != nullptr ? quantizedQValues->GetStorageMode() : EQValueStorageMode::Float))
+        return true;
+    payload->FoldRealtimeQValueDeltas();
+    // Quantized values go back through float tables first, so switching to Int8 works out fresh ranges for each goal.
+    const RoomTargetsQValuesRewardsSets& qValuesRewardsSets = quantizedQValues != nullptr ? payload->GetMutableQValuesRewardsSets() : payload->GetQValuesRewardsSets();
+    if (storageMode != EQValueStorageMode::Float && qValuesRewardsSets.IsAllocated())
+        payload->Quantize(MakeUnique<QuantizedQValuesTable>(qValuesRewardsSets, storageMode));
+    return true;
+}
+
+#if !UE_BUILD_SHIPPING
+void ATPGameDemoGameState::BenchmarkCellLayouts(int roomSideLength)
+{
+    // A 32 KB cache, about the size of an L1.
+    TArray<FCellLayoutBenchmarkResult> results;
+    CellLayoutBenchmark::Run(roomSideLength, 16, 1 << 20, 512, results);
+    for (const FCellLayoutBenchmarkResult& result : results)
+    {
+        UE_LOG(LogTemp, Log, TEXT("%s layout, %dx%d room: sweeps %.3f ms (%.3f misses per cell), walk %.3f ms (%.3f misses per step)."), 
+               result.Layout == ECellLayout::Morton ? TEXT("Morton") : TEXT("Row major"), roomSideLength, roomSideLength, 
+               result.SweepSeconds * 1000.0, result.SweepMissesPerCell, result.WalkSeconds * 1000.0, result.WalkMissesPerStep);
+    }
 }
 
-const QValuesRewardsSet& ATPGameDemoGameState::GetRoomQValuesRewardsSetForTargetPosition(FIntPoint roomCoords, FIntPoint targetPosition)
+void ATPGameDemoGameState::BenchmarkWorldCellQueries(int numQueries)
+{
+    // Walks randomly from cells of the trained rooms, as exploring enemies would, going back to a start cell whenever a move fails 
+    // or leaves the trained rooms. Both walks take the same actions, so their checksums should match.
+    const int numRoomsY = RoomStates.Num() > 0 ? RoomStates[0].Num() : 0;
+    TArray<bool> roomsTrained;
+    TArray<FRoomPositionPair> startCells;
+    for (int x = 0; x < RoomStates.Num(); ++x)
+    {
+        for (int y = 0; y < numRoomsY; ++y)
+        {
+            const RoomState& room = RoomStates[x][y];
+            const bool trained = room.Payload.IsValid() && (room.RoomStatus == RoomState::Status::Trained || room.RoomStatus == RoomState::Connected);
+            roomsTrained.Add(trained);
+            if (!trained)
+                continue;
+            for (int positionX = 0; positionX < NumGridUnitsX - 1; ++positionX)
+                for (int positionY = 0; positionY < NumGridUnitsY - 1; ++positionY)
+                    if (Get_ActionTargets(room.Payload->NavEnvironment, FIntPoint(positionX, positionY)).IsStateValid())
+                        startCells.Add({ GetRoomCoords(FIntPoint(x, y)), FIntPoint(positionX, positionY) });
+        }
+    }
+    if (startCells.Num() == 0 || numQueries <= 0)
+    {
+        UE_LOG(LogTemp, Warning, TEXT("There are no trained rooms to benchmark cell queries in."));
+        return;
+    }
+    TArray<FWorldCellId> startCellIds;
+    for (const FRoomPositionPair& startCell : startCells)
+        startCellIds.Add(GetWorldCellId(startCell));
+    TArray<EDirectionType> actions;
+    actions.SetNumUninitialized(numQueries);
+    for (int query = 0; query < numQueries; ++query)
+        actions[query] = (EDirectionType)FMath::RandRange(0, (int)EDirectionType::NumDirectionTypes - 1);
+    const FIntPoint goalPosition(NumGridUnitsX / 2, NumGridUnitsY / 2);
+    const FIntPoint roomIndicesOffset(NumGridsXY / 2, NumGridsXY / 2);
+
+    double startTime = FPlatformTime::Seconds();
+    int64 pairChecksum = 0;
+    FRoomPositionPair roomAndPosition = startCells[0];
+    for (int query = 0; query < numQueries; ++query)
+    {
+        pairChecksum += GetOptimalActions(roomAndPosition.RoomCoords, goalPosition, roomAndPosition.PositionInRoom).DirectionsMask;
+        const bool moved = SimulateAction(roomAndPosition, actions[query], goalPosition);
+        const FIntPoint roomIndices = roomAndPosition.RoomCoords + roomIndicesOffset;
+        if (!moved || !roomsTrained[roomIndices.X * numRoomsY + roomIndices.Y])
+            roomAndPosition = startCells[query % startCells.Num()];
+        pairChecksum += roomAndPosition.PositionInRoom.X * NumGridUnitsY + roomAndPosition.PositionInRoom.Y;
+    }
+    const double pairSeconds = FPlatformTime::Seconds() - startTime;
+
+    startTime = FPlatformTime::Seconds();
+    int64 cellChecksum = 0;
+    FWorldCellId cell = startCellIds[0];
+    for (int query = 0; query < numQueries; ++query)
+    {
+        cellChecksum += GetOptimalActions(cell, goalPosition).DirectionsMask;
+        const bool moved = SimulateAction(cell, actions[query], goalPosition);
+        const FIntPoint roomIndices = cell.GetRoomIndices();
+        if (!moved || !roomsTrained[roomIndices.X * numRoomsY + roomIndices.Y])
+            cell = startCellIds[query % startCellIds.Num()];
+        const FIntPoint positionInRoom = cell.GetPositionInRoom();
+        cellChecksum += positionInRoom.X * NumGridUnitsY + positionInRoom.Y;
+    }
+    const double cellSeconds = FPlatformTime::Seconds() - startTime;
+
+    UE_LOG(LogTemp, Log, TEXT("%d queries from %d cells: FRoomPositionPair %.1f ns per query, FWorldCellId %.1f ns per query (checksums %lld, %lld)."), 
+           numQueries, startCells.Num(), pairSeconds * 1e9 / numQueries, cellSeconds * 1e9 / numQueries, pairChecksum, cellChecksum);
+}
+#endif
+
+const QValuesRewardsSet ATPGameDemoGameState::GetRoomQValuesRewardsSetForTargetPosition(FIntPoint roomCoords, FIntPoint targetPosition)
 {
     return GetQValuesRewardsSet(roomCoords, targetPosition);
 }
@@ -143,19 +371,19 @@ bool ATPGameDemoGameState::IsRoomConnected(FIntPoint roomCoords) const
 
 bool ATPGameDemoGameState::IsRoomTrained(FIntPoint roomCoords) const
 {
-    auto room = GetRoomStateChecked(roomCoords);
+    const RoomState& room = GetRoomStateChecked(roomCoords);
     return room.RoomStatus == RoomState::Status::Trained || room.RoomStatus == RoomState::Connected;
 }
 
 bool ATPGameDemoGameState::DoesWallExist(FIntPoint roomCoords, EDirectionType wallType)
 {
-    auto wallState = GetWallState(roomCoords, wallType);
+    const WallState& wallState = GetWallState(roomCoords, wallType);
     return wallState.bWallExists;
 }
 
 bool ATPGameDemoGameState::DoesDoorExist(FIntPoint roomCoords, EDirectionType wallType)
 {
-    auto wallState = GetWallState(roomCoords, wallType);
+    const WallState& wallState = GetWallState(roomCoords, wallType);
 	if (!wallState.bWallExists && wallState.bDoorExists)
 	{
 		ensure(false); // Invalid state!
@@ -422,13 +650,20 @@ void ATPGameDemoGameState::UpdateSignalStrength(float delta)
     }
 }
 
-void ATPGameDemoGameState::SetBuildableItemPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction, bool placed)
+void ATPGameDemoGameState::SetBuildableItemPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction, bool placed, 
+                                                  EBuildableActorType buildableType /*= EBuildableActorType::None*/)
 {
-    FIntPoint roomIndices = GetRoomXYIndicesChecked(roomAndPosition.RoomCoords);
-    int unwrappedRoomIndex = roomIndices.Y * NumGridsXY + roomIndices.X;
-    int roomSize = NumGridUnitsX * NumGridUnitsY;
-    int unwrappedPositionInRoom = roomAndPosition.PositionInRoom.Y * NumGridUnitsX + roomAndPosition.PositionInRoom.X;
-    MazePositionBuildableStates[unwrappedRoomIndex * roomSize + unwrappedPositionInRoom].EnableDirection(direction);
+    if (placed)
+        Buildables.Place(roomAndPosition, direction, buildableType);
+    else
+        Buildables.Remove(roomAndPosition, direction);
+}
+
+TArray<FBuildablePlacement> ATPGameDemoGameState::GetBuildableItemsInRoom(FIntPoint roomCoords, EBuildableActorType buildableType) const
+{
+    TArray<FBuildablePlacement> placements;
+    Buildables.GetPlacementsInRoom(roomCoords, placements, buildableType);
+    return placements;
 }
 
 void ATPGameDemoGameState::SetRoomBuilder(FIntPoint roomCoords, ARoomBuilder* roomBuilderActor)
@@ -502,9 +737,12 @@ void ATPGameDemoGameState::EnableRoomState(FIntPoint roomCoords, float complexit
     FIntPoint roomIndices = GetRoomXYIndicesChecked(roomCoords);
     if (!DoesRoomExist(roomCoords))
     {
-        RoomStates[roomIndices.X][roomIndices.Y].InitializeRoom(MaxRoomHealth, complexity, density);
+        RoomStates[roomIndices.X][roomIndices.Y].InitializeRoom(FIntPoint(NumGridUnitsX, NumGridUnitsY), MaxRoomHealth, complexity, density, RoomCellLayout);
 
         RoomBuilders[roomIndices.X][roomIndices.Y]->BuildRoom(complexity, density);
+        // Building the room sets its structure, so it can pick up tables trained for the same layout, this session or an earlier one.
+        if (!ShareTrainedRoomTables(roomCoords) && BakeUntrainedRooms)
+            BakeRoomPolicy(roomCoords);
         FlagWallsForUpdate(roomCoords);
     }
 }
@@ -529,9 +767,28 @@ void ATPGameDemoGameState::SetRoomTrained(FIntPoint roomCoords)
         if (RoomStates[roomIndices.X][roomIndices.Y].RoomStatus != RoomState::Status::Connected)
             RoomStates[roomIndices.X][roomIndices.Y].SetRoomTrained();
         FlagWallsForUpdate(roomCoords);
+        // Only tables the trainer has finished with make it into the cache, so those are the ones that get written back.
+        if (RoomDatabase.IsValid())
+        {
+            const FRoomLayoutKey layout = GetRoomLayoutKey(roomCoords);
+            RoomDatabase->SaveAsync(layout, TrainedRooms.Find(layout));
+        }
+        if (FreezeTrainedRooms)
+            FreezeRoomPolicy(roomCoords);
+        else if (TrainedRoomQValueStorage != EQValueStorageMode::Float)
+            SetRoomQValueStorageMode(roomCoords, TrainedRoomQValueStorage);
     }
 }
 
+bool ATPGameDemoGameState::ExportSharedPolicyLibrary()
+{
+    if (!LevelPoliciesDirFound)
+        return false;
+    TArray<TPair<FRoomLayoutKey, RoomTargetsQValuesRewardsSetsPtr>> trainedLayouts;
+    TrainedRooms.GetCanonicalTrainedLayouts(trainedLayouts);
+    return SharedPolicyLibrary::Write(GetLevelPoliciesDir(), trainedLayouts);
+}
+
 void ATPGameDemoGameState::SetRoomTrainingProgress(FIntPoint roomCoords, float progress)
 {
     FIntPoint roomIndices = GetRoomXYIndicesChecked(roomCoords);
@@ -556,9 +813,9 @@ void ATPGameDemoGameState::SetRoomTrainingProgress(FIntPoint roomCoords, float p
 
 bool ATPGameDemoGameState::SimulateAction(FRoomPositionPair& roomAndPosition, EDirectionType actionToTake, FIntPoint targetPosition)
 {
-    ActionTargets& currentPosState = GetActionTargets(roomAndPosition);
-    FRoomPositionPair actionTarget = currentPosState.GetActionTarget(actionToTake);
-    WrapRoomPositionPair(actionTarget);
+    if (FindRoomPayload(roomAndPosition.RoomCoords) == nullptr)
+        return false;
+    const FRoomPositionPair actionTarget = GetActionTargets(roomAndPosition).GetActionTarget(roomAndPosition.RoomCoords, actionToTake);
     //UpdateQValueRealtime(roomAndPosition, actionToTake, targetPosition, 0.0f);
 
     if (actionTarget.PositionInRoom == roomAndPosition.PositionInRoom && actionTarget.RoomCoords == roomAndPosition.RoomCoords)
@@ -575,13 +832,51 @@ bool ATPGameDemoGameState::SimulateAction(FRoomPositionPair& roomAndPosition, ED
     return DoesRoomExist(roomAndPosition.RoomCoords) && InnerRoomPositionValid(roomAndPosition.PositionInRoom);
 }
 
+bool ATPGameDemoGameState::SimulateAction(FWorldCellId& cell, EDirectionType actionToTake, FIntPoint targetPosition)
+{
+    const RoomPayload* payload = FindRoomPayload(cell);
+    if (payload == nullptr)
+        return false;
+    const FIntPoint roomIndices = cell.GetRoomIndices();
+    const FIntPoint positionInRoom = cell.GetPositionInRoom();
+    const ActionTargets& targets = Get_ActionTargets(payload->NavEnvironment, positionInRoom);
+    const FIntPoint targetRoomIndices = roomIndices + targets.GetTargetRoomOffset(actionToTake);
+    const FIntPoint targetPositionInRoom = targets.GetWrappedTargetPosition(actionToTake);
+    if (targetPositionInRoom == positionInRoom && targetRoomIndices == roomIndices)
+        return false;
+    // The FRoomPositionPair version would index outside the room grid here.
+    if (!RoomXYIndicesValid(targetRoomIndices))
+        return false;
+    cell = FWorldCellId(targetRoomIndices, targetPositionInRoom);
+    // The same checks as the FRoomPositionPair version, minus InnerRoomPositionValid: targets are already wrapped.
+    if (IsOnGridEdge(targetPositionInRoom))
+    {
+        const FIntPoint neighbourIndices = LevelBuilderHelpers::GetTargetPointForAction(roomIndices, actionToTake);
+        return RoomXYIndicesValid(neighbourIndices) && RoomStates[neighbourIndices.X][neighbourIndices.Y].RoomExists();
+    }
+    return RoomStates[targetRoomIndices.X][targetRoomIndices.Y].RoomExists();
+}
+
 void ATPGameDemoGameState::UpdateQValueRealtime(FRoomPositionPair& roomAndPosition, EDirectionType actionToTake, FIntPoint targetPosition, float accumulatedReward, float learningRate)
 {
-    ActionTargets& currentPosState = GetActionTargets(roomAndPosition);
-    FRoomPositionPair actionTarget = currentPosState.GetActionTarget(actionToTake);
-    WrapRoomPositionPair(actionTarget);
-    bool movingFromTarget = roomAndPosition.PositionInRoom == targetPosition;
-    bool actionLeadsToSameRoom = actionTarget.RoomCoords == roomAndPosition.RoomCoords;
+    UpdateQValueRealtime(FindRoomPayload(roomAndPosition.RoomCoords), roomAndPosition.PositionInRoom, actionToTake, targetPosition, accumulatedReward, learningRate);
+}
+
+void ATPGameDemoGameState::UpdateQValueRealtime(FWorldCellId cell, EDirectionType actionToTake, FIntPoint targetPosition, float accumulatedReward, float learningRate)
+{
+    UpdateQValueRealtime(FindRoomPayload(cell), cell.GetPositionInRoom(), actionToTake, targetPosition, accumulatedReward, learningRate);
+}
+
+void ATPGameDemoGameState::UpdateQValueRealtime(RoomPayload* payload, FIntPoint positionInRoom, EDirectionType actionToTake, FIntPoint targetPosition, float accumulatedReward, float learningRate)
+{
+    // Frozen rooms have no Q values left to learn in.
+    if (payload == nullptr || payload->IsFrozen())
+        return;
+    QuantizedQValuesTable* quantizedQValues = payload->GetQuantizedQValues();
+    const ActionTargets& targets = Get_ActionTargets(payload->NavEnvironment, positionInRoom);
+    const FIntPoint actionTargetPosition = targets.GetWrappedTargetPosition(actionToTake);
+    bool movingFromTarget = positionInRoom == targetPosition;
+    bool actionLeadsToSameRoom = targets.GetTargetRoomOffset(actionToTake) == FIntPoint(0, 0);
     //bool leavingDestingationRoom = roomAndPosition.RoomCoords == destinationRoomCoords && !actionLeadsToSameRoom;
     bool updateQValue = !movingFromTarget;// actionLeadsToSameRoom || leavingDestingationRoom;
     if (updateQValue)
@@ -589,16 +884,29 @@ void ATPGameDemoGameState::UpdateQValueRealtime(FRoomPositionPair& roomAndPositi
         float maxNextReward = 0.0f;
         if (actionLeadsToSameRoom)
         {
-            FDirectionSet nextValidActions = GetValidActions(roomAndPosition);
-            maxNextReward = GetActionQValuesRewards(actionTarget, targetPosition).GetOptimalQValueAndActions_Valid(nextValidActions);
+            FDirectionSet nextValidActions = GetValidActions(payload->NavEnvironment, positionInRoom);
+            maxNextReward = quantizedQValues != nullptr ? quantizedQValues->GetOptimalQValueAndActions_Valid(targetPosition, actionTargetPosition, nextValidActions, 
+                                                                                                              payload->RealtimeLearning.Find(targetPosition, actionTargetPosition))
+                                                        : static_cast<const RoomPayload*>(payload)->GetLearningActionQValuesAndRewards(targetPosition, actionTargetPosition).GetOptimalQValueAndActions_Valid(nextValidActions);
         }
         else
         {
             maxNextReward = -1.0f; // leaving room without reaching target
         }
-        ActionQValuesAndRewards& currentNavState = GetActionQValuesRewards(roomAndPosition, targetPosition);
+        if (quantizedQValues != nullptr)
+        {
+            // The observed reward goes in the overlay as for float tables; only the Q value is requantized.
+            payload->RealtimeLearning.FindOrAdd(targetPosition, positionInRoom).RewardTrackers[(int)actionToTake].AddObservation(accumulatedReward);
+            const float currentQValue = quantizedQValues->GetQValue(targetPosition, positionInRoom, actionToTake);
+            const float discountedNextReward = GridTrainingConstants::ActorDiscountFactor * maxNextReward;
+            const float immediateReward = quantizedQValues->GetActionReward(targetPosition, positionInRoom, actionToTake) + accumulatedReward;
+            const float deltaQ = learningRate * (immediateReward + discountedNextReward - currentQValue);
+            quantizedQValues->UpdateQValue(targetPosition, positionInRoom, actionToTake, learningRate, deltaQ);
+            return;
+        }
+        ActionQValuesAndRewards currentNavState = payload->GetLearningActionQValuesAndRewards(targetPosition, positionInRoom);
         currentNavState.AddActionRewardObservation(actionToTake, accumulatedReward);
-        const float currentQValue = currentNavState.GetQValues()[(int)actionToTake];
+        const float currentQValue = currentNavState.GetQValue(actionToTake);
         const float discountedNextReward = GridTrainingConstants::ActorDiscountFactor * maxNextReward;
         const float immediateReward = currentNavState.GetRewards()[(int)actionToTake] + accumulatedReward;
         const float deltaQ = learningRate * (immediateReward + discountedNextReward - currentQValue);
@@ -608,18 +916,38 @@ void ATPGameDemoGameState::UpdateQValueRealtime(FRoomPositionPair& roomAndPositi
 
 void ATPGameDemoGameState::UpdateQValue(const FRoomPositionPair& roomAndPosition, FIntPoint goalPosition, EDirectionType actionToTake, float learningRate, float deltaQ)
 {
-    ActionQValuesAndRewards& currentNavState = GetActionQValuesRewards(roomAndPosition, goalPosition);
-    currentNavState.UpdateQValue(actionToTake, learningRate, deltaQ);
+    RoomPayload* payload = FindRoomPayload(roomAndPosition.RoomCoords);
+    if (payload == nullptr || payload->IsFrozen())
+        return;
+    if (QuantizedQValuesTable* quantizedQValues = payload->GetQuantizedQValues())
+        quantizedQValues->UpdateQValue(goalPosition, roomAndPosition.PositionInRoom, actionToTake, learningRate, deltaQ);
+    else
+        GetMutableActionQValuesRewards(roomAndPosition, goalPosition).UpdateQValue(actionToTake, learningRate, deltaQ);
 }
 
 void ATPGameDemoGameState::UpdateRoomNavEnvironmentForStructure(FIntPoint roomCoords, TArray<TArray<int>> roomStructure)
 {
-    GetNavigationEnvironmentForRoom(roomStructure, roomCoords, GetmNavEnvironment(roomCoords));
+    if (RoomPayload* payload = FindRoomPayload(roomCoords))
+    {
+        GetNavigationEnvironmentForRoom(roomStructure, roomCoords, payload->NavEnvironment, payload->GetCellLayout());
+        RefreshFrozenPolicy(roomCoords, *payload);
+    }
 }
 
 void ATPGameDemoGameState::UpdateRoomNavEnvironment(FIntPoint roomCoords, const NavigationEnvironment& navEnvironment)
 {
-    GetmNavEnvironment(roomCoords) = navEnvironment;
+    if (RoomPayload* payload = FindRoomPayload(roomCoords))
+    {
+        payload->NavEnvironment = navEnvironment;
+        RefreshFrozenPolicy(roomCoords, *payload);
+    }
+}
+
+void ATPGameDemoGameState::RefreshFrozenPolicy(FIntPoint roomCoords, RoomPayload& payload)
+{
+    // The frozen policy was compiled for the old structure: it would steer enemies into new walls, and has nothing for cells that opened up.
+    if (payload.IsFrozen() && !BakeRoomPolicy(roomCoords))
+        payload.ReindexQValuesRewardsSets();
 }
 
 void ATPGameDemoGameState::SetRoomQValuesRewardsSet(FIntPoint roomCoords, FIntPoint targetPosition, const QValuesRewardsSet& navSet)
@@ -630,37 +958,15 @@ void ATPGameDemoGameState::SetRoomQValuesRewardsSet(FIntPoint roomCoords, FIntPo
 
 void ATPGameDemoGameState::ClearQValuesAndRewards(FIntPoint RoomCoords, FIntPoint GoalPosition)
 {
-    FIntPoint roomIndices = GetRoomXYIndicesChecked(RoomCoords);
-    QValuesRewardsSet& set = RoomStates[roomIndices.X][roomIndices.Y].QValuesRewardsSets[GoalPosition.X][GoalPosition.Y];
-    for (int x = 0; x < set.Num(); ++x)
-    {
-        for (int y = 0; y < set[0].Num(); ++y)
-        {
-            set[x][y].ResetQValues();
-            // Could also enforce behaviour where you move in from the edges:
-            /*if (x == 0)
-            {
-                set[x][y].UpdateQValue(EDirectionType::North, 100.0f);
-            }
-            else if (y == 0)
-            {
-                set[x][y].UpdateQValue(EDirectionType::East, 100.0f);
-            }
-            else if (x == Environment.Num() - 1)
-            {
-                set[x][y].UpdateQValue(EDirectionType::South, 100.0f);
-            }
-            else if (y == Environment[0].Num() - 1)
-            {
-                set[x][y].UpdateQValue(EDirectionType::West, 100.0f);
-            }*/
-        }
-    }
+    RoomPayload* payload = FindRoomPayload(RoomCoords);
+    if (payload != nullptr && !payload->IsBeingTrained())
+        payload->GetMutableQValuesRewardsSets().GetQValuesRewardsSet(GoalPosition).ResetQValues();
 }
 
 void ATPGameDemoGameState::SetPositionIsGoal(FIntPoint RoomCoords, FIntPoint GoalPosition, bool isGoal)
 {
-    GetmNavEnvironment(RoomCoords)[GoalPosition.X][GoalPosition.Y].SetIsGoal(isGoal);
+    if (RoomPayload* payload = FindRoomPayload(RoomCoords))
+        Get_mActionTargets(payload->NavEnvironment, GoalPosition).SetIsGoal(isGoal);
 }
 
 void ATPGameDemoGameState::EnableWallState(FIntPoint roomCoords, EDirectionType wallType)
@@ -869,32 +1175,78 @@ void ATPGameDemoGameState::SetEnemyMovementPaused(bool MovementPaused)
 }
 //============================================================================
 //============================================================================
-const NavigationEnvironment& ATPGameDemoGameState::GetNavEnvironment(FIntPoint roomCoords) const
+RoomPayloadPtr ATPGameDemoGameState::GetRoomPayload(FIntPoint roomCoords) const
 {
-    FIntPoint roomIndices = GetRoomXYIndicesChecked(roomCoords);
-    return RoomStates[roomIndices.X][roomIndices.Y].NavEnvironment;
+    ensure(IsInGameThread());
+    return GetRoomStateChecked(roomCoords).Payload;
 }
 
-NavigationEnvironment& ATPGameDemoGameState::GetmNavEnvironment(FIntPoint roomCoords)
+RoomPayload* ATPGameDemoGameState::FindRoomPayload(FIntPoint roomCoords) const
 {
-    FIntPoint roomIndices = GetRoomXYIndicesChecked(roomCoords);
-    return RoomStates[roomIndices.X][roomIndices.Y].NavEnvironment;
+    return GetRoomStateChecked(roomCoords).Payload.Get();
+}
+
+RoomPayload* ATPGameDemoGameState::FindRoomPayload(FWorldCellId cell) const
+{
+    const FIntPoint roomIndices = cell.GetRoomIndices();
+    if (!cell.IsValid() || !RoomXYIndicesValid(roomIndices))
+        return nullptr;
+    return RoomStates[roomIndices.X][roomIndices.Y].Payload.Get();
+}
+
+FDirectionSet ATPGameDemoGameState::GetOptimalActions(const RoomPayload* payload, FIntPoint targetGridPosition, FIntPoint currentGridPosition)
+{
+    if (payload == nullptr)
+        return FDirectionSet();
+    FDirectionSet directionSet = GetValidActions(payload->NavEnvironment, currentGridPosition);
+    if (!directionSet.IsValid())
+        return directionSet;
+    // Doors open and close without the room's structure changing, so the frozen actions are masked by the ones valid right now.
+    if (payload->IsFrozen())
+        return FDirectionSet(payload->GetFrozenPolicy()->GetOptimalActions(targetGridPosition, currentGridPosition).DirectionsMask & directionSet.DirectionsMask);
+    if (payload->GetQuantizedQValues() != nullptr)
+    {
+        payload->GetQuantizedQValues()->GetOptimalQValueAndActions_Valid(targetGridPosition, currentGridPosition, directionSet, 
+                                                                          payload->RealtimeLearning.Find(targetGridPosition, currentGridPosition));
+        return directionSet;
+    }
+    payload->GetLearningActionQValuesAndRewards(targetGridPosition, currentGridPosition).GetOptimalQValueAndActions_Valid(directionSet);
+    return directionSet;
+}
+
+const NavigationEnvironment& ATPGameDemoGameState::GetNavEnvironment(FIntPoint roomCoords) const
+{
+    static const NavigationEnvironment EmptyNavEnvironment;
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    return payload != nullptr ? payload->NavEnvironment : EmptyNavEnvironment;
 }
 
 ActionTargets& ATPGameDemoGameState::GetActionTargets(FRoomPositionPair roomAndPosition)
 {
-    return Get_mActionTargets(GetmNavEnvironment(roomAndPosition.RoomCoords), roomAndPosition.PositionInRoom);
+    RoomPayload* payload = FindRoomPayload(roomAndPosition.RoomCoords);
+    ensure(payload != nullptr);
+    return Get_mActionTargets(payload->NavEnvironment, roomAndPosition.PositionInRoom);
 }
 
-QValuesRewardsSet& ATPGameDemoGameState::GetQValuesRewardsSet(FIntPoint roomCoords, FIntPoint targetPosition)
+const QValuesRewardsSet ATPGameDemoGameState::GetQValuesRewardsSet(FIntPoint roomCoords, FIntPoint targetPosition) const
 {
-    FIntPoint roomIndices = GetRoomXYIndicesChecked(roomCoords);
-    return Get_mQValuesRewardsSet_For_GoalPosition(RoomStates[roomIndices.X][roomIndices.Y].QValuesRewardsSets, targetPosition);
+    RoomPayload* payload = FindRoomPayload(roomCoords);
+    ensure(payload != nullptr);
+    return payload->GetQValuesRewardsSets().GetQValuesRewardsSet(targetPosition);
 }
 
-ActionQValuesAndRewards& ATPGameDemoGameState::GetActionQValuesRewards(const FRoomPositionPair& roomAndPosition, FIntPoint targetPosition)
+const ActionQValuesAndRewards ATPGameDemoGameState::GetActionQValuesRewards(const FRoomPositionPair& roomAndPosition, FIntPoint targetPosition) const
 {
-    return ::Get_mActionQValuesAndRewards(GetQValuesRewardsSet(roomAndPosition.RoomCoords, targetPosition), roomAndPosition.PositionInRoom);
+    RoomPayload* payload = FindRoomPayload(roomAndPosition.RoomCoords);
+    ensure(payload != nullptr);
+    return static_cast<const RoomPayload*>(payload)->GetLearningActionQValuesAndRewards(targetPosition, roomAndPosition.PositionInRoom);
+}
+
+ActionQValuesAndRewards ATPGameDemoGameState::GetMutableActionQValuesRewards(const FRoomPositionPair& roomAndPosition, FIntPoint targetPosition)
+{
+    RoomPayload* payload = FindRoomPayload(roomAndPosition.RoomCoords);
+    ensure(payload != nullptr);
+    return payload->GetLearningActionQValuesAndRewards(targetPosition, roomAndPosition.PositionInRoom);
 }
 
 FIntPoint ATPGameDemoGameState::GetRoomXYIndicesChecked(FIntPoint roomCoords) const
@@ -1003,13 +1355,34 @@ FRoomPositionPair ATPGameDemoGameState::GetRoomAndPositionForWorldXY(FVector2D w
     return  { roomCoords, positionInRoom };
 }
 
+FWorldCellId ATPGameDemoGameState::GetWorldCellId(FRoomPositionPair roomAndPosition)
+{
+    WrapRoomPositionPair(roomAndPosition);
+    const FIntPoint roomIndices(roomAndPosition.RoomCoords.X + NumGridsXY / 2, roomAndPosition.RoomCoords.Y + NumGridsXY / 2);
+    if (!RoomXYIndicesValid(roomIndices))
+        return FWorldCellId();
+    return FWorldCellId(roomIndices, roomAndPosition.PositionInRoom);
+}
+
+FRoomPositionPair ATPGameDemoGameState::GetRoomAndPosition(FWorldCellId cell) const
+{
+    ensure(cell.IsValid());
+    return { GetRoomCoords(cell.GetRoomIndices()), cell.GetPositionInRoom() };
+}
+
+FVector2D ATPGameDemoGameState::GetWorldXYForCell(FWorldCellId cell)
+{
+    return GetWorldXYForRoomAndPosition(GetRoomAndPosition(cell));
+}
+
+FWorldCellId ATPGameDemoGameState::GetWorldCellIdForWorldXY(FVector2D worldXY)
+{
+    return GetWorldCellId(GetRoomAndPositionForWorldXY(worldXY));
+}
+
 bool ATPGameDemoGameState::IsBuildableItemPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction)
 {
-    FIntPoint roomIndices = GetRoomXYIndicesChecked(roomAndPosition.RoomCoords);
-    int unwrappedRoomIndex = roomIndices.Y * NumGridsXY + roomIndices.X;
-    int roomSize = NumGridUnitsX * NumGridUnitsY;
-    int unwrappedPositionInRoom = roomAndPosition.PositionInRoom.Y * NumGridUnitsX + roomAndPosition.PositionInRoom.X;
-    return MazePositionBuildableStates[unwrappedRoomIndex * roomSize + unwrappedPositionInRoom].CheckDirection(direction);
+    return Buildables.IsPlaced(roomAndPosition, direction);
 }
 
 WallState& ATPGameDemoGameState::GetWallState(FIntPoint roomCoords, EDirectionType direction)
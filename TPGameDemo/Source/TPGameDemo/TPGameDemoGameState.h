@@ -153,13 +153,60 @@ public:
     UFUNCTION(BlueprintCallable, Category = "Room Grid Positions")
         FRoomPositionPair GetRoomAndPositionForWorldXY(FVector2D worldXY);
 
+    /** Wraps the position, then packs it with its room. Returns an invalid cell if the room is outside the world. */
+    FWorldCellId GetWorldCellId(FRoomPositionPair roomAndPosition);
+    /** The wrapped room and position of the cell. */
+    FRoomPositionPair GetRoomAndPosition(FWorldCellId cell) const;
+    FVector2D GetWorldXYForCell(FWorldCellId cell);
+    FWorldCellId GetWorldCellIdForWorldXY(FVector2D worldXY);
+
     UFUNCTION(BlueprintCallable, Category = "World Rooms States")
         bool IsBuildableItemPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction);
 
+    /* Every item placed in the room, or only those of buildableType unless it's None. */
+    UFUNCTION(BlueprintCallable, Category = "World Rooms States")
+        TArray<FBuildablePlacement> GetBuildableItemsInRoom(FIntPoint roomCoords, EBuildableActorType buildableType) const;
+
     // --------------------- room properties -------------------------------------
+    /* Returns a shared reference to the room's Q tables, nav environment and tile counters, or null if the room doesn't exist. 
+       Call this on the game thread; the returned reference can then be handed to other threads. */
+    RoomPayloadPtr GetRoomPayload(FIntPoint roomCoords) const;
+    /* Returns an empty environment if the room doesn't exist. */
     const NavigationEnvironment& GetNavEnvironment(FIntPoint roomCoords) const;
     const RoomTargetsQValuesRewardsSets& GetRoomQValuesRewardsSets(FIntPoint roomCoords);
-    const QValuesRewardsSet& GetRoomQValuesRewardsSetForTargetPosition(FIntPoint roomCoords, FIntPoint targetPosition);
+    FRoomLayoutKey GetRoomLayoutKey(FIntPoint roomCoords);
+    /* Points the room at the trained tables of an earlier room with the same layout. Returns false if there aren't any, or the 
+       room is being trained. */
+    bool ShareTrainedRoomTables(FIntPoint roomCoords);
+    /* Makes the room's tables available to later rooms with the same layout. Call once the room has finished training. */
+    void AddRoomTablesToTrainedCache(FIntPoint roomCoords);
+    /* Compiles the room's trained tables into a FrozenPolicyTable and drops them. Enemies then read their optimal actions straight 
+       from it, but nothing can learn in the room any more: realtime Q updates are ignored until it is retrained. Returns false 
+       while a trainer thread is writing the tables. */
+    UFUNCTION(BlueprintCallable, Category = "World Rooms Training")
+        bool FreezeRoomPolicy(FIntPoint roomCoords);
+    /* Freezes the room with the shortest-path policies of its layout (a RoomDistanceField), without training it. Training the room 
+       later replaces them. Returns false for rooms that aren't 10x10, which don't fit in an InnerRoomBitmask, and for rooms that are 
+       being trained. */
+    UFUNCTION(BlueprintCallable, Category = "World Rooms Training")
+        bool BakeRoomPolicy(FIntPoint roomCoords);
+    /* The number of moves from position to goalPosition inside the room, going by its layout. -1 if there's no way through, or if 
+       the room doesn't exist or isn't 10x10. */
+    UFUNCTION(BlueprintCallable, Category = "World Rooms States")
+        int GetRoomPathLength(FIntPoint roomCoords, FIntPoint goalPosition, FIntPoint position);
+    /* Swaps the room's trained tables for Half or Int8 Q values (Float puts the float tables back). Enemies keep learning in 
+       quantized rooms; training the room again goes back to float tables. Returns false while the room is being trained. */
+    UFUNCTION(BlueprintCallable, Category = "World Rooms Training")
+        bool SetRoomQValueStorageMode(FIntPoint roomCoords, EQValueStorageMode storageMode);
+#if !UE_BUILD_SHIPPING
+    /* Logs how the cell layouts compare for sweeps and random walks in an open room of the given size. See CellLayoutBenchmark. 
+       Run from the console with TPGameDemo.BenchmarkCellLayouts [roomSideLength]. */
+    void BenchmarkCellLayouts(int roomSideLength = 128);
+    /* Logs how long an enemy step's GetOptimalActions and SimulateAction queries take from random cells of the trained rooms, 
+       through FRoomPositionPairs and through FWorldCellIds. Run from the console with TPGameDemo.BenchmarkWorldCellQueries [numQueries]. */
+    void BenchmarkWorldCellQueries(int numQueries = 1000000);
+#endif
+    const QValuesRewardsSet GetRoomQValuesRewardsSetForTargetPosition(FIntPoint roomCoords, FIntPoint targetPosition);
 
     UFUNCTION(BlueprintCallable, Category = "World Rooms States")
         bool DoesRoomExist(FIntPoint roomCoords) const;
@@ -236,19 +283,28 @@ public:
 
     FDirectionSet GetOptimalActions(FIntPoint roomCoords, FIntPoint targetGridPosition, FIntPoint currentGridPosition)
     {
-        FDirectionSet directionSet = GetValidActions({roomCoords, currentGridPosition});
-        GetActionQValuesRewards({ roomCoords, currentGridPosition }, targetGridPosition).GetOptimalQValueAndActions_Valid(directionSet);
-        return directionSet;
+        return GetOptimalActions(FindRoomPayload(roomCoords), targetGridPosition, currentGridPosition);
+    }
+
+    FDirectionSet GetOptimalActions(FWorldCellId cell, FIntPoint targetGridPosition)
+    {
+        return GetOptimalActions(FindRoomPayload(cell), targetGridPosition, cell.GetPositionInRoom());
     }
 
     float GetExploreProbability(FIntPoint roomCoords, FIntPoint targetGridPosition, FIntPoint currentGridPosition)
     {
+        const RoomPayload* payload = FindRoomPayload(roomCoords);
+        if (payload == nullptr || !payload->HasFloatQValues())
+            return 0.0f;
         return GetActionQValuesRewards({ roomCoords, currentGridPosition }, targetGridPosition).GetExploreProbability();
     }
 
     void IncrementExploreCount(FIntPoint roomCoords, FIntPoint targetGridPosition, FIntPoint currentGridPosition)
     {
-        GetActionQValuesRewards({ roomCoords, currentGridPosition }, targetGridPosition).IncrementExplorations();
+        const RoomPayload* payload = FindRoomPayload(roomCoords);
+        if (payload == nullptr || !payload->HasFloatQValues())
+            return;
+        GetMutableActionQValuesRewards({ roomCoords, currentGridPosition }, targetGridPosition).IncrementExplorations();
     }
 
     UFUNCTION(BlueprintCallable, Category = "World Room Building")
@@ -256,19 +312,14 @@ public:
 
     FDirectionSet GetValidActions(FRoomPositionPair roomAndPosition)
     {
-        const NavigationEnvironment& environment = GetNavEnvironment(roomAndPosition.RoomCoords);
-        FDirectionSet directions;
-        directions.Clear();
-        for (int i = (int)EDirectionType::North; i < (int)EDirectionType::NumDirectionTypes; ++i)
-        {
-            FIntPoint position = roomAndPosition.PositionInRoom;
-            FRoomPositionPair actionTarget = environment[position.X][position.Y].GetActionTarget((EDirectionType)i);
-            WrapRoomPositionPair(actionTarget);
-            FIntPoint targetPos = actionTarget.PositionInRoom;
-            if (targetPos != roomAndPosition.PositionInRoom || actionTarget.RoomCoords != roomAndPosition.RoomCoords)
-                directions.EnableDirection((EDirectionType)i);
-        }
-        return directions;
+        return GetValidActions(GetNavEnvironment(roomAndPosition.RoomCoords), roomAndPosition.PositionInRoom);
+    }
+
+    static FDirectionSet GetValidActions(const NavigationEnvironment& environment, FIntPoint positionInRoom)
+    {
+        if (environment.NumX() == 0)
+            return FDirectionSet();
+        return FDirectionSet(environment.GetValidActionsMask(positionInRoom));
     }
     //============================================================================
     // Modifiers
@@ -323,7 +374,7 @@ public:
         void UpdateSignalStrength(float delta);
 
     UFUNCTION(BlueprintCallable, Category = "World Rooms States")
-        void SetBuildableItemPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction, bool placed);
+        void SetBuildableItemPlaced(FRoomPositionPair roomAndPosition, EDirectionType direction, bool placed, EBuildableActorType buildableType = EBuildableActorType::None);
 
     // --------------------- Room & Wall Initialization / Destruction -------------------------------------
     void SetRoomInnerStructure(FIntPoint roomCoords, InnerRoomBitmask roomBitmask);
@@ -347,20 +398,27 @@ public:
     UFUNCTION(BlueprintCallable, Category = "World Rooms Training")
         void SetRoomTrained(FIntPoint roomCoords);
 
+    /* Writes every layout trained so far to the shared policy library, for game instances started from now on to map. */
+    UFUNCTION(BlueprintCallable, Category = "World Rooms Training")
+        bool ExportSharedPolicyLibrary();
+
     /* Return true if the action leads somewhere. */
     bool SimulateAction(FRoomPositionPair& roomAndPosition, EDirectionType actionToTake, FIntPoint targetPosition);
+    bool SimulateAction(FWorldCellId& cell, EDirectionType actionToTake, FIntPoint targetPosition);
     /* A realtime version of UpdateQValue. This is to be performed by actors as they navigate the level.*/
     void UpdateQValueRealtime(FRoomPositionPair& roomAndPosition, EDirectionType actionToTake, FIntPoint targetPosition, float accumulatedReward, float learningRate);
+    void UpdateQValueRealtime(FWorldCellId cell, EDirectionType actionToTake, FIntPoint targetPosition, float accumulatedReward, float learningRate);
     /* Update the qvalue for an action from a given position in a given room for a given goal position.*/
     void UpdateQValue(const FRoomPositionPair& roomAndPosition, FIntPoint goalPosition, EDirectionType actionToTake, float learningRate, float deltaQ);
     /* Update the qvalue for an action from a given position in a given room.*/
     void UpdateQValueForCurrentNavState(EDirectionType actionType, float learningRate, float deltaQ);
-    /* Set the action targets for the room, given the cell state structure */
+    /* Set the action targets for the room, given the cell state structure. A frozen room's policy is baked again for the new 
+       structure, or, if the room can't be baked, it's thawed and has to be trained again. */
     void UpdateRoomNavEnvironmentForStructure(FIntPoint roomCoords, TArray<TArray<int>> roomStructure);
     void UpdateRoomNavEnvironment(FIntPoint roomCoords, const NavigationEnvironment& navEnvironment);
-    /* Set the qvalues and rewards set for a target position in a room. */
+    /* Set the qvalues and rewards set for a target position in a room. Ignored while the room is being trained. */
     void SetRoomQValuesRewardsSet(FIntPoint RoomCoords, FIntPoint targetPosition, const QValuesRewardsSet& navSet);
-    /* Reset the action qvalues and rewards on a given position for a given goal position in a room. */
+    /* Reset the action qvalues and rewards on a given position for a given goal position in a room. Ignored while the room is being trained. */
     void ClearQValuesAndRewards(FIntPoint RoomCoords, FIntPoint GoalPosition);
     /* Set whether a position in a room is the goal position. Used by LevelTrainerComponent when training. */
     void SetPositionIsGoal(FIntPoint RoomCoords, FIntPoint GoalPosition, bool isGoal);
@@ -442,6 +500,24 @@ public:
     UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "World Room Health")
         float MaxSignalStrength = 100.0f;
 
+    /* Freeze rooms as soon as they are trained. Only for levels whose enemies don't update Q values (UpdateQValue off), 
+       since a frozen room ignores their updates. */
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "World Rooms Training")
+        bool FreezeTrainedRooms = false;
+
+    /* Bake shortest-path policies into new rooms that have no trained tables to share (see BakeRoomPolicy), so enemies can find 
+       their way around before the room is trained. */
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "World Rooms Training")
+        bool BakeUntrainedRooms = false;
+
+    /* How rooms keep their Q values once they are trained, unless they are frozen. Float is the full tables. */
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "World Rooms Training")
+        EQValueStorageMode TrainedRoomQValueStorage = EQValueStorageMode::Float;
+
+    /* The order new rooms store their cells in. Morton only starts to pay off in rooms much bigger than the usual 10x10. */
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "World Rooms Training")
+        ECellLayout RoomCellLayout = ECellLayout::RowMajor;
+
     //============================================================================
     // Enemy Movement
     //============================================================================        
@@ -456,19 +532,34 @@ private:
     TArray<TArray<AWallBuilder*>> WallBuilders;
 	TArray<TArray<RoomState>> RoomStates;
 
-    NavigationEnvironment& GetmNavEnvironment(FIntPoint roomCoords);
+    /* Null if the room doesn't exist. */
+    RoomPayload* FindRoomPayload(FIntPoint roomCoords) const;
+    /* Also null for invalid cells. */
+    RoomPayload* FindRoomPayload(FWorldCellId cell) const;
+    FDirectionSet GetOptimalActions(const RoomPayload* payload, FIntPoint targetGridPosition, FIntPoint currentGridPosition);
+    /* Called once the room's NavEnvironment has changed. See UpdateRoomNavEnvironmentForStructure. */
+    void RefreshFrozenPolicy(FIntPoint roomCoords, RoomPayload& payload);
+    void UpdateQValueRealtime(RoomPayload* payload, FIntPoint positionInRoom, EDirectionType actionToTake, FIntPoint targetPosition, float accumulatedReward, float learningRate);
+    /* Expects the room to exist. */
     ActionTargets& GetActionTargets(FRoomPositionPair roomAndPosition);
-    QValuesRewardsSet& GetQValuesRewardsSet(FIntPoint roomCoords, FIntPoint targetPosition);
-    ActionQValuesAndRewards& GetActionQValuesRewards(const FRoomPositionPair& roomAndPosition, FIntPoint targetPosition);
+    const QValuesRewardsSet GetQValuesRewardsSet(FIntPoint roomCoords, FIntPoint targetPosition) const;
+    const ActionQValuesAndRewards GetActionQValuesRewards(const FRoomPositionPair& roomAndPosition, FIntPoint targetPosition) const;
+    /* Learns into the room's realtime learning overlay, so shared Q tables stay shared. */
+    ActionQValuesAndRewards GetMutableActionQValuesRewards(const FRoomPositionPair& roomAndPosition, FIntPoint targetPosition);
+
+    TrainedRoomCache TrainedRooms;
 
     bool LevelPoliciesDirFound = false;
+    /* Trained tables saved in the level policies dir. Null if the dir wasn't found. */
+    TUniquePtr<TrainedRoomDatabase> RoomDatabase;
+    /* Mapped from the level policies dir. Null if there's no library there. */
+    TUniquePtr<SharedPolicyLibrary> PolicyLibrary;
 
     EnemiesPausedChangedEvent EnemiesPausedChanged;
     
-    // An unwrapped '2d' array containing An FDirectionSet for each space in the maze,
-    // indicating if a buildable has been placed facing each direction.
-    // (This is mainly applicable to turrets attached to walls).
-    TArray<FDirectionSet> MazePositionBuildableStates;
+    // The buildables placed in the maze, and the directions they face.
+    // (Direction is mainly applicable to turrets attached to walls).
+    FBuildableRegistry Buildables;
     
     // Struct containing the coordinates of a west/south wall state couple and the specific wall type.
     struct WallPosition